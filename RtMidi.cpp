@@ -39,6 +39,7 @@
 
 #include "RtMidi.h"
 #include <sstream>
+#include <chrono>
 
 #if defined(__MACOSX_CORE__)
   #if TARGET_OS_IPHONE
@@ -270,6 +271,29 @@ class MidiOutDummy: public MidiOutApi
 
 #endif
 
+// In-process input, always compiled.  It has a single port, messages
+// are fed by injectMessage() and delivered like those of a device.
+
+class MidiInLoopback: public MidiInApi
+{
+ public:
+  MidiInLoopback( const std::string &/*clientName*/, unsigned int queueSizeLimit ) : MidiInApi( queueSizeLimit ) {}
+  RtMidi::Api getCurrentApi( void ) { return RtMidi::RTMIDI_LOOPBACK; }
+  void openPort( unsigned int portNumber, const std::string &portName );
+  void openVirtualPort( const std::string &portName ) { openPort( 0, portName ); }
+  void closePort( void ) { connected_ = false; inputData_.doInput = false; }
+  void setClientName( const std::string &/*clientName*/ ) {};
+  void setPortName( const std::string &/*portName*/ ) {};
+  unsigned int getPortCount( void ) { return 1; }
+  std::string getPortName( unsigned int portNumber ) { return portNumber == 0 ? "Loopback" : ""; }
+  bool injectMessage( const unsigned char *message, size_t size );
+
+ protected:
+  void initialize( const std::string& /*clientName*/ ) {}
+
+  std::chrono::steady_clock::time_point lastTime_;
+};
+
 //*********************************************************************//
 //  RtMidi Definitions
 //*********************************************************************//
@@ -300,12 +324,14 @@ const char* rtmidi_api_names[][2] = {
   { "jack"        , "Jack" },
   { "winmm"       , "Windows MultiMedia" },
   { "dummy"       , "Dummy" },
+  { "loopback"    , "Loopback" },
 };
 const unsigned int rtmidi_num_api_names =
   sizeof(rtmidi_api_names)/sizeof(rtmidi_api_names[0]);
 
 // The order here will control the order of RtMidi's API search in
-// the constructor.
+// the constructor. RTMIDI_LOOPBACK is left out, it never receives
+// anything unless the application feeds it and is only opened on request.
 extern "C" const RtMidi::Api rtmidi_compiled_apis[] = {
 #if defined(__MACOSX_CORE__)
   RtMidi::MACOSX_CORE,
@@ -405,6 +431,8 @@ void RtMidiIn :: openMidiApi( RtMidi::Api api, const std::string &clientName, un
   if ( api == RTMIDI_DUMMY )
     rtapi_ = new MidiInDummy( clientName, queueSizeLimit );
 #endif
+  if ( api == RTMIDI_LOOPBACK )
+    rtapi_ = new MidiInLoopback( clientName, queueSizeLimit );
 }
 
 RTMIDI_DLL_PUBLIC RtMidiIn :: RtMidiIn( RtMidi::Api api, const std::string &clientName, unsigned int queueSizeLimit )
@@ -617,6 +645,13 @@ void MidiInApi :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
   if ( midiSense ) inputData_.ignoreFlags |= 0x04;
 }
 
+bool MidiInApi :: injectMessage( const unsigned char * /*message*/, size_t /*size*/ )
+{
+  errorString_ = "RtMidiIn::injectMessage: only supported by the loopback API.";
+  error( RtMidiError::WARNING, errorString_ );
+  return false;
+}
+
 double MidiInApi :: getMessage( std::vector<unsigned char> *message )
 {
   message->clear();
@@ -691,6 +726,59 @@ bool MidiInApi::MidiQueue::pop( std::vector<unsigned char> *msg, double* timeSta
   return true;
 }
 
+//*********************************************************************//
+//  API: Loopback
+//*********************************************************************//
+
+void MidiInLoopback :: openPort( unsigned int portNumber, const std::string &/*portName*/ )
+{
+  if ( connected_ ) {
+    errorString_ = "MidiInLoopback::openPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+  if ( portNumber != 0 ) {
+    std::ostringstream ost;
+    ost << "MidiInLoopback::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::INVALID_PARAMETER, errorString_ );
+    return;
+  }
+  inputData_.firstMessage = true;
+  inputData_.doInput = true;
+  connected_ = true;
+}
+
+bool MidiInLoopback :: injectMessage( const unsigned char *message, size_t size )
+{
+  RtMidiInData *data = &inputData_;
+  if ( !data->doInput || size == 0 ) return false;
+
+  // Filter as the device backends do
+  unsigned char status = message[0];
+  if ( status == 0xF0 && ( data->ignoreFlags & 0x01 ) ) return false;
+  if ( ( status == 0xF1 || status == 0xF8 ) && ( data->ignoreFlags & 0x02 ) ) return false;
+  if ( status == 0xFE && ( data->ignoreFlags & 0x04 ) ) return false;
+
+  // Time in seconds since the previous message, zero for the first one
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double timeStamp = 0.0;
+  if ( data->firstMessage ) data->firstMessage = false;
+  else timeStamp = std::chrono::duration<double>( now - lastTime_ ).count();
+  lastTime_ = now;
+
+  // reuses the message buffer, no allocation once it is large enough
+  data->message.bytes.assign( message, message + size );
+  data->message.timeStamp = timeStamp;
+
+  if ( data->usingCallback ) {
+    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
+    callback( timeStamp, &data->message.bytes, data->userData );
+    return true;
+  }
+  return data->queue.push( data->message );
+}
+
 //*********************************************************************//
 //  Common MidiOutApi Definitions
 //*********************************************************************//
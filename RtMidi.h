@@ -140,6 +140,7 @@ class RTMIDI_DLL_PUBLIC RtMidi
     UNIX_JACK,      /*!< The JACK Low-Latency MIDI Server API. */
     WINDOWS_MM,     /*!< The Microsoft Multimedia MIDI API. */
     RTMIDI_DUMMY,   /*!< A compilable but non-functional API. */
+    RTMIDI_LOOPBACK, /*!< An in-process input fed with RtMidiIn::injectMessage. */
     NUM_APIS        /*!< Number of values in this enum. */
   };
 
@@ -262,7 +263,7 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
 
     If no API argument is specified and multiple API support has been
     compiled, the default order of use is ALSA, JACK (Linux) and CORE,
-    JACK (OS-X).
+    JACK (OS-X).  The RTMIDI_LOOPBACK API is only used when requested.
 
     \param api        An optional API id can be specified.
     \param clientName An optional client name can be specified. This
@@ -364,6 +365,18 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
   */
   double getMessage( std::vector<unsigned char> *message );
 
+  //! Feed a MIDI message to an open input of the RTMIDI_LOOPBACK API.
+  /*!
+    The message goes through the same path as one received from a
+    device : it is filtered by ignoreTypes(), stamped with the time
+    elapsed since the previous message and passed to the user callback
+    or queued for getMessage().  It can be called from any single
+    producer thread.  Returns false if the message was not delivered
+    (port closed, message ignored or queue full) or if the current API
+    is not RTMIDI_LOOPBACK.
+  */
+  bool injectMessage( const unsigned char *message, size_t size );
+
   //! Set an error callback function to be invoked when an error has occured.
   /*!
     The callback function will be called whenever an error has occured. It is best
@@ -535,6 +548,7 @@ class RTMIDI_DLL_PUBLIC MidiInApi : public MidiApi
   void cancelCallback( void );
   virtual void ignoreTypes( bool midiSysex, bool midiTime, bool midiSense );
   double getMessage( std::vector<unsigned char> *message );
+  virtual bool injectMessage( const unsigned char *message, size_t size );
 
   // A MIDI structure used internally by the class to store incoming
   // messages.  Each message represents one and only one MIDI message.
@@ -613,6 +627,7 @@ inline unsigned int RtMidiIn :: getPortCount( void ) { return rtapi_->getPortCou
 inline std::string RtMidiIn :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
 inline void RtMidiIn :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense ) { static_cast<MidiInApi *>(rtapi_)->ignoreTypes( midiSysex, midiTime, midiSense ); }
 inline double RtMidiIn :: getMessage( std::vector<unsigned char> *message ) { return static_cast<MidiInApi *>(rtapi_)->getMessage( message ); }
+inline bool RtMidiIn :: injectMessage( const unsigned char *message, size_t size ) { return static_cast<MidiInApi *>(rtapi_)->injectMessage( message, size ); }
 inline void RtMidiIn :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 inline RtMidi::Api RtMidiOut :: getCurrentApi( void ) throw() { return rtapi_->getCurrentApi(); }
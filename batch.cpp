@@ -0,0 +1,113 @@
+#include "batch.h"
+#include "mid_file.h"
+#include "synth.h"
+#include "render.h"
+#include "wav.h"
+#include "resampler.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static vector<string> list_mid_files(const string &source) {
+    vector<string> files;
+    auto ext = fs::path(source).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == ".mid" || ext == ".midi") {
+        files.push_back(source);
+    } else if (fs::is_directory(source)) {
+        for (auto &entry : fs::directory_iterator(source)) {
+            auto ext = entry.path().extension().string();
+            transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            if (entry.is_regular_file() && (ext == ".mid" || ext == ".midi"))
+                files.push_back(entry.path().string());
+        }
+        sort(files.begin(), files.end());
+    } else {
+        ifstream list(source);
+        for (string line; getline(list, line);) {
+            if (!line.empty()) files.push_back(line);
+        }
+    }
+    return files;
+}
+
+int render_batch(const string &source, const string &output_dir,
+    float tuning, int channel, const string &cache_dir, size_t segments, dither_mode dithering,
+    unsigned int channels, unsigned int rate, unsigned int output_rate) {
+
+    auto files = list_mid_files(source);
+    if (files.empty()) {
+        cout << "No mid file found in " << source << endl;
+        return 0;
+    }
+    if (!output_dir.empty()) fs::create_directories(output_dir);
+
+    // ouch owie my ears
+    const float volume = 0.25;
+    Synth engine(rate, tuning, channel);
+    engine.channels = channels;
+
+    // files share the cores : one worker per file, each decoding and splitting its file
+    // on its share of them
+    size_t cores = max(1u, thread::hardware_concurrency());
+    size_t nthreads = min<size_t>(cores, files.size());
+    size_t file_threads = max<size_t>(1, cores/nthreads);
+
+    mutex report;
+    atomic<size_t> next_file(0);
+    atomic<int> failed(0);
+    double total_audio = 0;
+
+    auto worker = [&]() {
+        flush_denormals();
+        for (size_t f = next_file++; f < files.size(); f = next_file++) {
+            auto &input_mid = files[f];
+            fs::path output = fs::path(input_mid).replace_extension(".wav");
+            if (!output_dir.empty()) output = fs::path(output_dir) / output.filename();
+
+            auto begin = chrono::steady_clock::now();
+            vector<float> mix;
+            try {
+                auto events = load_mid_file(input_mid, cache_dir, file_threads);
+                if (segments > 1) mix = render_mid_segmented(events, engine, segments, file_threads);
+                else mix = render_mid(events, engine);
+                mix = resample(mix, rate, output_rate, channels);
+            } catch (const char* e) {
+                lock_guard<mutex> lock(report);
+                cout << input_mid << " : " << e << endl;
+                failed++;
+                continue;
+            }
+            double render_time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            auto samples = to_int16(mix, volume, dithering, channels);
+            write_wav(output.string(), samples, channels, output_rate);
+
+            double audio_time = samples.size()/(double)(output_rate*channels);
+            lock_guard<mutex> lock(report);
+            total_audio += audio_time;
+            cout << input_mid << " : " << audio_time << "s rendered in " << render_time << "s ("
+                << audio_time/render_time << "x realtime)" << endl;
+        }
+    };
+
+    auto begin = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (size_t i=1;i<nthreads;i++) pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool) t.join();
+    double wall_time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    cout << files.size() - failed << "/" << files.size() << " files, " << total_audio << "s of audio in "
+        << wall_time << "s on " << nthreads << " threads (" << total_audio/wall_time << "x realtime, "
+        << (files.size() - failed)/wall_time << " files/s)" << endl;
+    return failed;
+}
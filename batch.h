@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include "dither.h"
+
+// Renders every mid file of source (a mid file, a directory, or a text file listing one path per line)
+// to a wav file, on a pool of workers sized to the machine. Wav files are written to
+// output_dir, or next to each mid file if it is empty.
+// Each file is decoded on its share of the cores, and with segments > 1 also split in that
+// many segments rendered in parallel on that share.
+// Samples are dithered to 16 bits according to dithering, files have channels channels.
+// The engine renders at rate, files are resampled to output_rate if it differs.
+// Prints timings for each file and for the whole batch, returns the number of failed files.
+int render_batch(const std::string &source, const std::string &output_dir,
+    float tuning, int channel, const std::string &cache_dir, size_t segments = 1,
+    dither_mode dithering = dither_mode::tpdf, unsigned int channels = 2,
+    unsigned int rate = 48000, unsigned int output_rate = 48000);
@@ -0,0 +1,264 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <cstdio>
+
+#include "synth.h"
+#include "render_workers.h"
+#include "limiter.h"
+#include "dither.h"
+#include "resampler.h"
+#include "process_args.h"
+
+using namespace std;
+
+// Microbenchmarks of the synthesis primitives
+
+// results go there so the compiler keeps the benchmarked code
+static volatile float sink;
+
+const unsigned int rate = 48000;
+const size_t frames = rate/100;
+
+struct bench_result {
+    string name;
+    int voices;             // 0 for primitives
+    double ns_per_sample;   // per call for primitives, per output sample for renders
+};
+
+// Best time per sample over several runs, each run calling func (which processes
+// samples samples) until min_time elapsed
+template <typename F>
+static double measure(F func, size_t samples, double min_time = 0.05, int runs = 5) {
+    double best = INFINITY;
+    for (int r=0;r<runs;r++) {
+        size_t calls = 0;
+        auto begin = chrono::steady_clock::now();
+        double elapsed = 0;
+        do {
+            func();
+            calls++;
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        } while (elapsed < min_time);
+        best = min(best, elapsed*1e9/(calls*samples));
+    }
+    return best;
+}
+
+// Synth with voices notes held, envelopes settled on sustain
+static Synth held_voices(int voices) {
+    Synth synth(rate);
+    for (int v=0;v<voices;v++) synth.process_message({0x90, (unsigned char)(21 + v), 100});
+    synth.advance(rate);
+    return synth;
+}
+
+int main(int argc, char ** argv) {
+    string format = "table";
+    register_arg("json", "j", "print results as json", [&](){ format = "json"; });
+    register_arg("csv", "c", "print results as csv", [&](){ format = "csv"; });
+    process_args(argc, argv);
+    // as every audio thread does
+    flush_denormals();
+
+    vector<bench_result> results;
+    const size_t n = 4096;
+
+    auto primitive = [&](string name, auto func) {
+        results.push_back({name, 0, measure([&](){
+            float acc = 0;
+            for (size_t i=0;i<n;i++) acc += func(i);
+            sink = acc;
+        }, n)});
+    };
+
+    primitive("t_freq", [](size_t i){ return t_freq(i, 440.f, rate); });
+    primitive("square_wave", [](size_t i){ return square_wave(i*(1.f/n)); });
+    primitive("sine_wave", [](size_t i){ return sine_wave(i*(1.f/n)); });
+    primitive("saw_wave", [](size_t i){ return saw_wave(i*(1.f/n)); });
+    primitive("triangle_wave", [](size_t i){ return triangle_wave(i*(1.f/n)); });
+    primitive("polyblep_square", [](size_t i){ return polyblep_square(i*(1.f/n), 0.05f); });
+    primitive("polyblep_saw", [](size_t i){ return polyblep_saw(i*(1.f/n), 0.05f); });
+    primitive("polyblamp_triangle", [](size_t i){ return polyblamp_triangle(i*(1.f/n), 0.05f); });
+    primitive("synth_sound", [](size_t i){ return synth_sound(i*(1.f/n)); });
+    primitive("convert", [](size_t i){ return (float)convert(i*(2.f/n) - 1.f, 0.25); });
+    primitive("velocity_curve", [](size_t i){ return velocity_curve(i & 0x7F); });
+
+    // ADSR update of 88 voices in decay, restarted from the same state for every period
+    {
+        Synth synth(rate);
+        for (int v=0;v<88;v++) synth.process_message({0x90, (unsigned char)(21 + v), 100});
+        synth.advance(synth.attack_time*rate + frames);
+        auto decaying = synth.snapshot();
+        results.push_back({"adsr_update", 88, measure([&](){
+            synth.restore(decaying);
+            synth.advance(frames);
+        }, frames)});
+    }
+
+    // Full period render
+    for (int voices : {1, 8, 32, 88}) {
+        auto synth = held_voices(voices);
+        vector<float> out(frames);
+        results.push_back({"render_period", voices, measure([&](){
+            synth.render(out.data(), frames);
+            sink = out[0];
+        }, frames)});
+    }
+
+    // Same in stereo, voices rendered once and split
+    {
+        auto synth = held_voices(32);
+        synth.channels = 2;
+        vector<float> out(frames*2);
+        results.push_back({"render_period_stereo", 32, measure([&](){
+            synth.render(out.data(), frames);
+            sink = out[0];
+        }, frames)});
+    }
+
+    // Full period render of each instrument kernel
+    for (int id=0;id<instrument_count();id++) {
+        auto synth = held_voices(32);
+        synth.instrument = id;
+        vector<float> out(frames);
+        results.push_back({string("render_") + instrument_name(id), 32, measure([&](){
+            synth.render(out.data(), frames);
+            sink = out[0];
+        }, frames)});
+    }
+
+    // Same with the recurrence and spectral additive engines, for instruments made of sine partials
+    for (auto name : {"organ", "clarinet", "strings", "bright", "piano"}) {
+        for (auto engine : {additive_engine::recurrence, additive_engine::spectral}) {
+            auto synth = held_voices(32);
+            synth.instrument = instrument_index(name);
+            synth.additive = engine;
+            vector<float> out(frames);
+            string suffix = engine == additive_engine::recurrence ? "_recurrence" : "_spectral";
+            results.push_back({string("render_") + name + suffix, 32, measure([&](){
+                synth.render(out.data(), frames);
+                sink = out[0];
+            }, frames)});
+        }
+    }
+
+    // Full period render with voice groups on workers, every core busy
+    {
+        size_t threads = max(1u, thread::hardware_concurrency()) - 1;
+        render_workers workers(threads);
+        auto synth = held_voices(88);
+        synth.workers = &workers;
+        synth.parallel_voices = 1;
+        vector<float> out(frames);
+        results.push_back({"render_period_" + to_string(threads + 1) + "_threads", 88, measure([&](){
+            synth.render(out.data(), frames);
+            sink = out[0];
+        }, frames)});
+    }
+
+    // Render time along a long release and into silence, flat as long as nothing
+    // computes on denormals. Each point renders a period from the same state
+    {
+        auto synth = held_voices(32);
+        synth.release_time = 4;
+        synth.release_all();
+        vector<float> out(frames);
+        float elapsed = 0;
+        for (float at : {0.01f, 1.f, 3.9f, 5.f}) {
+            synth.advance((at - elapsed)*rate);
+            elapsed = at;
+            auto state = synth.snapshot();
+            char name[32];
+            snprintf(name, sizeof(name), "release_tail_%gs", at);
+            results.push_back({name, 32, measure([&](){
+                synth.restore(state);
+                synth.render(out.data(), frames);
+                sink = out[0];
+            }, frames)});
+        }
+    }
+
+    // A one-pole filter ringing out, as filters and reverbs will, with its state in the
+    // denormal range : the cost flushing avoids
+    for (bool flushed : {false, true}) {
+        flush_denormals(flushed);
+        results.push_back({flushed ? "one_pole_tail_flushed" : "one_pole_tail_denormal", 0, measure([&](){
+            float y = 1e-39f;
+            for (size_t i=0;i<n;i++) y = y*0.9999f + 1e-45f*(i & 1);
+            sink = y;
+        }, n)});
+    }
+    flush_denormals();
+
+    // Lookahead limiter on a mix peaking over its ceiling
+    {
+        limiter master(rate, 1, 0.5f);
+        vector<float> mix(frames);
+        for (size_t i=0;i<frames;i++) mix[i] = sine_wave(i*(1.f/frames));
+        results.push_back({"limiter", 0, measure([&](){
+            master.process(mix.data(), frames);
+            sink = mix[0];
+        }, frames)});
+    }
+
+    // Conversion of a quiet mix to 16 bits, with each dither
+    for (auto mode : {dither_mode::tpdf, dither_mode::shaped}) {
+        ditherer d(mode);
+        vector<float> mix(frames);
+        vector<int16_t> samples(frames);
+        for (size_t i=0;i<frames;i++) mix[i] = 0.001f*sine_wave(i*(1.f/frames));
+        results.push_back({mode == dither_mode::tpdf ? "dither_tpdf" : "dither_shaped", 0, measure([&](){
+            d.convert(mix.data(), samples.data(), frames, 0.25f);
+            sink = samples[0];
+        }, frames)});
+    }
+
+    // Stereo period resampled from the engine rate to common device rates, per output sample
+    for (unsigned int out_rate : {44100u, 96000u}) {
+        resampler r(rate, out_rate, 2);
+        size_t out_frames = out_rate/100;
+        vector<float> mix(2*(frames + r.latency() + 2)), out(2*out_frames);
+        for (size_t i=0;i<mix.size();i++) mix[i] = sine_wave(i*(0.5f/frames));
+        results.push_back({"resample_stereo_" + to_string(out_rate), 0, measure([&](){
+            r.process(mix.data(), r.input_needed(out_frames), out.data(), out_frames);
+            sink = out[0];
+        }, out_frames)});
+    }
+
+    // voices one core can render in realtime
+    auto voices_per_core = [](const bench_result &r) {
+        return r.voices ? (1e9/rate)/(r.ns_per_sample/r.voices) : 0.0;
+    };
+
+    if (format == "json") {
+        cout << "[" << endl;
+        for (size_t i=0;i<results.size();i++) {
+            auto &r = results[i];
+            cout << "  {\"name\": \"" << r.name << "\", \"voices\": " << r.voices
+                << ", \"ns_per_sample\": " << r.ns_per_sample
+                << ", \"voices_per_core\": " << voices_per_core(r) << "}"
+                << (i+1 < results.size() ? "," : "") << endl;
+        }
+        cout << "]" << endl;
+    } else if (format == "csv") {
+        cout << "name,voices,ns_per_sample,voices_per_core" << endl;
+        for (auto &r : results) {
+            cout << r.name << "," << r.voices << "," << r.ns_per_sample << "," << voices_per_core(r) << endl;
+        }
+    } else {
+        cout << "Benchmark at " << rate << "Hz, " << frames << " frames per period" << endl;
+        for (auto &r : results) {
+            cout << "\t" << r.name;
+            if (r.voices) cout << " (" << r.voices << " voices)";
+            cout << " : " << r.ns_per_sample << " ns/sample";
+            if (r.voices) cout << ", " << voices_per_core(r) << " voices per core";
+            cout << endl;
+        }
+    }
+    return 0;
+}
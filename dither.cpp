@@ -0,0 +1,66 @@
+#include "dither.h"
+#include "synth.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+ditherer::ditherer(dither_mode mode, unsigned int channels, uint32_t seed)
+    : mode(mode), channels(min(2u, max(1u, channels))) {
+    // distinct non-zero seeds for every lane
+    for (size_t l=0;l<lanes;l++) {
+        seed = seed*1664525u + 1013904223u;
+        state[l] = seed | 1;
+    }
+}
+
+// error feedback filter for 44.1-48kHz (Wannamaker's 3 taps)
+static const float shaping[3] = {1.623f, -0.982f, 0.109f};
+
+void ditherer::convert(const float* in, int16_t* out, size_t count, float volume) {
+    if (mode == dither_mode::off) {
+        for (size_t i=0;i<count;i++) out[i] = ::convert(in[i], volume);
+        return;
+    }
+
+    // only grows, no allocation once the largest block went through
+    size_t padded = (count + lanes - 1)/lanes*lanes;
+    if (noise.size() < padded) noise.resize(padded);
+
+    // triangular noise in (-1, 1) steps, the difference of the two 16 bits halves
+    uint32_t s[lanes];
+    copy(state, state + lanes, s);
+    float* n = noise.data();
+    for (size_t i=0;i<padded;i+=lanes) {
+        for (size_t l=0;l<lanes;l++) {
+            s[l] ^= s[l] << 13;
+            s[l] ^= s[l] >> 17;
+            s[l] ^= s[l] << 5;
+            n[i+l] = ((int32_t)(s[l] & 0xFFFF) - (int32_t)(s[l] >> 16))*(1.f/65536);
+        }
+    }
+    copy(s, s + lanes, state);
+
+    const float scale = volume*0x7FFE;
+    if (mode == dither_mode::tpdf) {
+        for (size_t i=0;i<count;i++) {
+            float v = min(32766.f, max(-32766.f, in[i]*scale + noise[i]));
+            // rounding, the offset keeps the value positive so truncation floors it
+            out[i] = (int32_t)(v + 32768.5f) - 32768;
+        }
+        return;
+    }
+
+    for (size_t i=0, c=0;i<count;i++) {
+        float* e = error[c];
+        float v = in[i]*scale - (shaping[0]*e[0] + shaping[1]*e[1] + shaping[2]*e[2]);
+        // rounding as above, bounded far past full scale first
+        float q = (int32_t)(min(65000.f, max(-65000.f, v + noise[i])) + 65536.5f) - 65536;
+        e[2] = e[1];
+        e[1] = e[0];
+        // error of the unsaturated value, clipping must not feed back
+        e[0] = q - v;
+        out[i] = (int16_t)min(32766.f, max(-32766.f, q));
+        if (++c == channels) c = 0;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// How float samples become 16 bits
+enum class dither_mode {
+    off,    // truncated by convert(), quantization error follows the signal
+    tpdf,   // triangular dither of +-1 step, error turned into steady white noise
+    shaped, // tpdf with the error fed back through a 3 taps filter, pushing the noise
+            // towards high frequencies where it is heard least
+};
+
+// Float to 16 bits conversion with dither, block by block.
+// Noise comes from independent xorshift generators, one per lane, so a block of noise
+// is generated with vector instructions. Deterministic for a given seed.
+// Samples of up to 2 channels are interleaved, each one shapes its own noise
+class ditherer {
+public:
+    explicit ditherer(dither_mode mode, unsigned int channels = 1, uint32_t seed = 0x9E3779B9);
+
+    // Converts count samples scaled by volume, full scale at 1, saturated as convert() does
+    void convert(const float* in, int16_t* out, size_t count, float volume);
+
+    dither_mode mode;
+    unsigned int channels;
+
+private:
+    static const size_t lanes = 8;
+    uint32_t state[lanes];
+    std::vector<float> noise;   // per block scratch, in steps
+    float error[2][3] = {};     // last quantization errors of each channel, most recent first
+};
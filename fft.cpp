@@ -0,0 +1,34 @@
+#include "fft.h"
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+void fft(vector<complex<float>> &x, bool inverse) {
+    size_t n = x.size();
+
+    // bit reversal permutation
+    for (size_t i=1, j=0;i<n;i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) swap(x[i], x[j]);
+    }
+
+    // butterflies
+    for (size_t len=2;len<=n;len<<=1) {
+        double angle = (inverse ? 2 : -2)*M_PI/len;
+        complex<float> w_len(cos(angle), sin(angle));
+        for (size_t i=0;i<n;i+=len) {
+            complex<float> w(1);
+            for (size_t j=0;j<len/2;j++) {
+                auto u = x[i+j];
+                auto v = x[i+j+len/2]*w;
+                x[i+j] = u + v;
+                x[i+j+len/2] = u - v;
+                w *= w_len;
+            }
+        }
+    }
+}
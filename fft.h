@@ -0,0 +1,8 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+
+// In-place radix-2 FFT, the size must be a power of two.
+// The inverse transform is not scaled, divide by the size to get back the input.
+void fft(std::vector<std::complex<float>> &x, bool inverse = false);
@@ -0,0 +1,281 @@
+#include "golden.h"
+#include "mid_file.h"
+#include "render.h"
+#include "wav.h"
+#include "fft.h"
+#include "limiter.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// renders are made like the batch mode ones
+const unsigned int golden_rate = 48000;
+const float golden_volume = 0.25;
+
+// Synthetic inputs, each one stressing a part of the synth
+
+static void note(vector<midi_event> &events, float timestamp, float length, unsigned char key, unsigned char velocity) {
+    events.push_back({timestamp, 0x90, key, velocity});
+    events.push_back({timestamp + length, 0x80, key, 0});
+}
+
+static vector<pair<string, mid_sequence>> synthetic_inputs() {
+    vector<pair<string, mid_sequence>> inputs;
+    auto add = [&](string name, vector<midi_event> events) {
+        stable_sort(events.begin(), events.end(), [](auto a, auto b){ return a.timestamp < b.timestamp; });
+        inputs.push_back({name, make_sequence(move(events))});
+    };
+
+    // major scale over the keyboard
+    vector<midi_event> scale;
+    int steps[] = {0, 2, 4, 5, 7, 9, 11};
+    for (int i=0;i<7*7;i++) note(scale, i*0.25f, 0.2f, 24 + (i/7)*12 + steps[i%7], 100);
+    add("scale", scale);
+
+    // chords held by the sustain pedal
+    vector<midi_event> chords;
+    for (int c=0;c<4;c++) {
+        chords.push_back({c*2.f, 0xB0, 64, 127});
+        for (int k : {48, 52, 55, 60}) note(chords, c*2.f, 0.5f, k + c*2, 90);
+        chords.push_back({c*2.f + 1.5f, 0xB0, 64, 0});
+    }
+    add("sustain_chords", chords);
+
+    // fast repeated notes on the same key, retriggered during their release
+    vector<midi_event> repeated;
+    for (int i=0;i<64;i++) note(repeated, i*0.0625f, 0.03f, 69, 40 + i);
+    add("repeated_notes", repeated);
+
+    // every key at once
+    vector<midi_event> keyboard;
+    for (int k=21;k<21+88;k++) note(keyboard, 0, 2, k, 64);
+    add("full_keyboard", keyboard);
+
+    // every velocity on one key
+    vector<midi_event> velocities;
+    for (int v=1;v<128;v++) note(velocities, v*0.125f, 0.1f, 60, v);
+    add("velocity_sweep", velocities);
+
+    return inputs;
+}
+
+// Comparison
+
+// SNR in dB between the magnitude spectra of frames of both signals, each channel apart,
+// insensitive to phase changes that do not alter the sound
+static float spectral_snr(const vector<int16_t> &reference, const vector<int16_t> &render, unsigned int channels) {
+    const size_t size = 2048;
+    const size_t hop = size/2;
+    size_t length = max(reference.size(), render.size())/channels;
+    double signal = 0, noise = 0;
+    vector<complex<float>> a(size), b(size);
+    for (unsigned int c=0;c<channels;c++) {
+        for (size_t start=0;start<length;start+=hop) {
+            for (size_t i=0;i<size;i++) {
+                float window = 0.5f - 0.5f*cos(2*M_PI*i/size);
+                size_t s = (start + i)*channels + c;
+                a[i] = s < reference.size() ? reference[s]*window : 0.f;
+                b[i] = s < render.size() ? render[s]*window : 0.f;
+            }
+            fft(a);
+            fft(b);
+            for (size_t i=0;i<=size/2;i++) {
+                float ma = abs(a[i]), mb = abs(b[i]);
+                signal += ma*ma;
+                noise += (ma - mb)*(ma - mb);
+            }
+        }
+    }
+    if (noise == 0) return INFINITY;
+    return 10*log10(signal/noise);
+}
+
+// Reference hashes, one "<name> <hash> <samples>" line per render
+
+// FNV-1a
+static uint64_t hash_samples(const vector<int16_t> &samples) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto bytes = (const unsigned char*)samples.data();
+    for (size_t i=0;i<samples.size()*sizeof(int16_t);i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+struct render_hash {
+    uint64_t hash;
+    size_t samples;
+};
+
+static map<string, render_hash> read_hashes(const string &path) {
+    map<string, render_hash> hashes;
+    ifstream file(path);
+    string name;
+    render_hash h;
+    while (file >> name >> hex >> h.hash >> dec >> h.samples) hashes[name] = h;
+    return hashes;
+}
+
+static void write_hashes(const string &path, const map<string, render_hash> &hashes) {
+    ofstream file(path);
+    for (auto &h : hashes) file << h.first << " " << hex << h.second.hash << dec << " " << h.second.samples << endl;
+}
+
+// settings part of reference names, like organ-direct-mono. Fixed renders checked exactly
+// have their own references, organ-direct-mono-fixed, otherwise they are compared to the float ones
+static string settings_name(const Synth &engine, bool exact) {
+    const char* engines[] = {"direct", "recurrence", "spectral"};
+    string name = instrument_name(engine.instrument);
+    if (engine.band_limited) name += "-bandlimited";
+    name += string("-") + engines[(int)engine.additive];
+    name += engine.channels == 2 ? "-stereo" : "-mono";
+#ifdef SYNTH_FIXED_POINT
+    if (exact) name += "-fixed";
+#endif
+    return name;
+}
+
+// Self-checks without reference
+
+// A0 sine far over the ceiling and slowly falling : the needed gain rises for longer than the
+// lookahead window. Every sample must leave at most at the ceiling
+static bool check_limiter_falling_bass(unsigned int channels) {
+    const size_t period = golden_rate/100;
+    limiter master(golden_rate, channels, 1);
+    vector<float> block(period*channels);
+    float peak = 0;
+    for (size_t t=0;t<4*golden_rate;) {
+        for (size_t i=0;i<period;i++,t++) {
+            float s = (3 - 1.4f*t/(4*golden_rate))*sin(2*M_PI*27.5*t/golden_rate);
+            for (size_t c=0;c<channels;c++) block[i*channels + c] = s;
+        }
+        master.process(block.data(), period);
+        for (auto s : block) peak = max(peak, fabs(s));
+    }
+    bool pass = peak <= 1;
+    cout << "limiter_falling_bass_" << channels << "ch : " << (pass ? "PASS" : "FAIL") << " peak " << peak << endl;
+    return pass;
+}
+
+int check_golden(const string &dir, const string &tolerance, bool update, const Synth &engine) {
+    // parse tolerance
+    string mode = tolerance.substr(0, tolerance.find(':'));
+    float limit = tolerance.find(':') == string::npos ? 0 : atof(&tolerance[tolerance.find(':') + 1]);
+    if (mode != "exact" && mode != "maxabs" && mode != "snr") {
+        cout << "Unknown tolerance " << tolerance << ", expected exact, maxabs:<error> or snr:<dB>" << endl;
+        return 1;
+    }
+
+    auto inputs = synthetic_inputs();
+    if (fs::is_directory(dir)) {
+        vector<string> files;
+        for (auto &entry : fs::directory_iterator(dir)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".mid") files.push_back(entry.path().string());
+        }
+        sort(files.begin(), files.end());
+        for (auto &f : files) {
+            try {
+                inputs.push_back({fs::path(f).stem().string(), load_mid_file(f)});
+            } catch (const char* e) {
+                cout << f << " : " << e << endl;
+            }
+        }
+    }
+    if (update) fs::create_directories(dir);
+
+    // the settings under test, rate and tuning fixed
+    Synth golden_engine(golden_rate, 440);
+    golden_engine.instrument = engine.instrument;
+    golden_engine.channels = engine.channels;
+#ifndef SYNTH_FIXED_POINT
+    // the fixed path only has the direct kernels
+    golden_engine.additive = engine.additive;
+    golden_engine.band_limited = engine.band_limited;
+#endif
+    unsigned int channels = engine.channels;
+
+    auto hashes_file = (fs::path(dir) / "hashes.txt").string();
+    auto hashes = read_hashes(hashes_file);
+
+    int failed = 0;
+    for (auto &input : inputs) {
+        string name = input.first + "." + settings_name(golden_engine, update || mode == "exact");
+        auto reference_file = (fs::path(dir) / (name + ".wav")).string();
+        auto render = to_int16(render_mid(input.second, golden_engine), golden_volume, dither_mode::off, channels);
+        render_hash rendered = {hash_samples(render), render.size()};
+
+        if (update) {
+            write_wav(reference_file, render, channels, golden_rate);
+            hashes[name] = rendered;
+            cout << reference_file << " written" << endl;
+            continue;
+        }
+
+        // without the wav, the exact render hash
+        if (!fs::exists(reference_file)) {
+            auto h = hashes.find(name);
+            bool pass = h != hashes.end() && h->second.hash == rendered.hash && h->second.samples == rendered.samples;
+            if (!pass) failed++;
+            char hash[17];
+            snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)rendered.hash);
+            cout << name << " : " << (pass ? "PASS" : "FAIL") << " hash " << hash;
+            if (h == hashes.end()) cout << ", no reference wav nor hash";
+            else if (mode != "exact") cout << ", exact (no reference wav)";
+            cout << endl;
+            continue;
+        }
+
+        vector<int16_t> reference;
+        unsigned int reference_channels = 1;
+        try {
+            reference = read_wav(reference_file, &reference_channels);
+        } catch (const char* e) {
+            cout << name << " : FAIL " << e << " " << reference_file << endl;
+            failed++;
+            continue;
+        }
+        if (reference_channels != channels) {
+            cout << name << " : FAIL " << reference_channels << " channels reference" << endl;
+            failed++;
+            continue;
+        }
+
+        int max_error = 0;
+        size_t common = min(reference.size(), render.size());
+        for (size_t i=0;i<common;i++) max_error = max(max_error, abs(reference[i] - render[i]));
+        float snr = spectral_snr(reference, render, channels);
+        bool same_length = reference.size() == render.size();
+
+        bool pass;
+        if (mode == "exact") pass = same_length && max_error == 0;
+        else if (mode == "maxabs") pass = same_length && max_error <= limit;
+        else pass = snr >= limit;
+        if (!pass) failed++;
+
+        cout << name << " : " << (pass ? "PASS" : "FAIL") << " max abs error " << max_error
+            << ", spectral SNR " << snr << "dB";
+        if (!same_length) cout << ", length " << render.size() << " instead of " << reference.size();
+        cout << endl;
+    }
+
+    if (update) {
+        write_hashes(hashes_file, hashes);
+        cout << hashes_file << " written" << endl;
+        return failed;
+    }
+    cout << inputs.size() - failed << "/" << inputs.size() << " renders within tolerance " << tolerance << endl;
+
+    int checks_failed = 0;
+    for (unsigned int channels : {1u, 2u}) checks_failed += !check_limiter_falling_bass(channels);
+    return failed + checks_failed;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include "synth.h"
+
+// Golden-render regression check
+// Renders a fixed set of synthetic sequences and every mid file of dir through the offline
+// path, at 48kHz and 440Hz with the instrument, additive engine, band limiting and channels
+// of engine, and compares them to the references stored in dir : <name>.<settings>.wav, or
+// failing that the hash of the exact render in dir/hashes.txt (what the repository keeps,
+// see make golden).
+// tolerance is "exact", "maxabs:<error in 16 bits steps>" or "snr:<minimum spectral SNR in dB>",
+// only exact applies to hashes.
+// A SYNTH_FIXED_POINT build renders the direct kernels whatever the engine options. Checked
+// exactly or updated, it has its own <name>.<settings>-fixed references, with a tolerance it is
+// compared to the float references <name>.<settings>.wav (see make golden FIXED=1).
+// With update set, reference wavs and hashes are (re)written instead.
+// Checks without reference follow, such as the limiter staying under its ceiling.
+// Prints a line per render, returns the number of renders and checks that failed.
+int check_golden(const std::string &dir, const std::string &tolerance, bool update, const Synth &engine);
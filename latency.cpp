@@ -0,0 +1,56 @@
+#include "latency.h"
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+latency_probe::latency_probe() {
+    // no allocation on the audio thread
+    pending.reserve(1024);
+    latencies.reserve(1 << 20);
+}
+
+void latency_probe::push(const unsigned char* message, size_t size) {
+    timed_message m;
+    m.size = min<size_t>(size, 3);
+    copy(message, message + m.size, m.bytes);
+    m.arrival = chrono::steady_clock::now();
+    queue.push(m);
+}
+
+bool latency_probe::pop(timed_message &m) {
+    return queue.pop(m);
+}
+
+void latency_probe::note_on(chrono::steady_clock::time_point arrival, int64_t onset) {
+    if (pending.size() < pending.capacity()) pending.push_back({arrival, onset});
+}
+
+void latency_probe::period_written(int64_t position, long delay, unsigned int rate) {
+    auto now = chrono::steady_clock::now();
+    for (auto &p : pending) {
+        // the sample plays once the queued frames and the samples before it in the period are out
+        double until_output = (delay + (p.onset - position))/(double)rate;
+        double latency = chrono::duration<double>(now - p.arrival).count() + until_output;
+        if (latencies.size() < latencies.capacity()) latencies.push_back(latency);
+        if (verbose) cout << "Note-on latency : " << latency*1000 << "ms" << endl;
+    }
+    pending.clear();
+}
+
+void latency_probe::report() const {
+    if (latencies.empty()) {
+        cout << "No note-on latency measured" << endl;
+        return;
+    }
+    auto sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) { return sorted[min(sorted.size()-1, (size_t)(p*sorted.size()))]*1000; };
+    cout << "Note-on latency over " << sorted.size() << " notes : min " << sorted.front()*1000
+        << "ms, p50 " << percentile(0.5) << "ms, p90 " << percentile(0.9) << "ms, p99 " << percentile(0.99)
+        << "ms, max " << sorted.back()*1000 << "ms" << endl;
+}
+
+void latency_midi_callback(double timeStamp, vector<unsigned char> *message, void *userData) {
+    ((latency_probe*)userData)->push(message->data(), message->size());
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include "spsc_queue.h"
+
+// Note-on latency measurement, from the arrival of a note-on in the midi input thread
+// to the time its first sample reaches the output device
+
+// midi message stamped on arrival
+struct timed_message {
+    unsigned char bytes[3];
+    size_t size;
+    std::chrono::steady_clock::time_point arrival;
+};
+
+class latency_probe {
+public:
+    latency_probe();
+
+    // Midi input thread : stamps and queues an incoming message
+    void push(const unsigned char* message, size_t size);
+
+    // Audio thread : next queued message
+    bool pop(timed_message &m);
+
+    // Audio thread : a note-on takes effect at sample onset
+    void note_on(std::chrono::steady_clock::time_point arrival, int64_t onset);
+
+    // Audio thread : the period starting at sample position is about to be written,
+    // with delay frames still queued in the device before it
+    void period_written(int64_t position, long delay, unsigned int rate);
+
+    // Prints the latency distribution
+    void report() const;
+
+    bool verbose = false;
+
+private:
+    spsc_queue<timed_message, 1024> queue;
+
+    struct pending_note {
+        std::chrono::steady_clock::time_point arrival;
+        int64_t onset;
+    };
+    std::vector<pending_note> pending;
+
+    // latencies in seconds
+    std::vector<double> latencies;
+};
+
+// RtMidiIn callback feeding a latency_probe passed as user data
+void latency_midi_callback(double timeStamp, std::vector<unsigned char> *message, void *userData);
@@ -0,0 +1,80 @@
+#include "limiter.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+limiter::limiter(unsigned int rate, unsigned int channels, float ceiling, float lookahead, float release)
+    : channels(max(1u, channels)), ceiling(ceiling), window(max<size_t>(1, lookahead*rate)),
+    release_coef(exp(-1/(max(release, 1e-4f)*rate))),
+    delay(window*this->channels, 0.f), box(window, 1.f), box_sum(window), inverse_window(1.0/window),
+    queue_gain(window), queue_time(window) {}
+
+void limiter::process(float* samples, size_t frames) {
+    // only grows, no allocation once the largest block went through
+    if (gains.size() < frames) gains.resize(frames);
+
+    // gain each frame needs to stay under the ceiling
+    if (channels == 1) {
+        for (size_t i=0;i<frames;i++) {
+            float a = fabs(samples[i]);
+            gains[i] = a > ceiling ? ceiling/a : 1.f;
+        }
+    } else {
+        for (size_t i=0;i<frames;i++) {
+            float a = 0;
+            for (size_t c=0;c<channels;c++) a = max(a, fabs(samples[i*channels + c]));
+            gains[i] = a > ceiling ? ceiling/a : 1.f;
+        }
+    }
+
+    for (size_t i=0;i<frames;i++) {
+        // minimum over the window, the queue drops needs a lower one came after.
+        // The need leaving the window goes first : the queue then holds at most window - 1
+        // needs before the new one, even while needs keep rising
+        float g = gains[i];
+        auto slot = [&](size_t k) { size_t s = queue_front + k; return s < window ? s : s - window; };
+        if (queue_size > 0 && queue_time[queue_front] + window <= time) {
+            queue_front = slot(1);
+            queue_size--;
+        }
+        while (queue_size > 0 && queue_gain[slot(queue_size - 1)] >= g) queue_size--;
+        size_t back = slot(queue_size);
+        queue_gain[back] = g;
+        queue_time[back] = time;
+        queue_size++;
+        released = min(queue_gain[queue_front], 1 - (1 - released)*release_coef);
+
+        // the average of the held gains over the window is at most the need of the sample
+        // leaving the delay now, since each of them was held over it
+        box_sum += released - box[cursor];
+        box[cursor] = released;
+        gains[i] = box_sum*inverse_window;
+
+        float* newest = &delay[cursor*channels];
+        if (++cursor == window) cursor = 0;
+        const float* oldest = &delay[cursor*channels];
+        for (size_t c=0;c<channels;c++) {
+            newest[c] = samples[i*channels + c];
+            samples[i*channels + c] = oldest[c];
+        }
+        time++;
+    }
+
+    float block_lowest = 1;
+    if (channels == 1) {
+        for (size_t i=0;i<frames;i++) samples[i] *= gains[i];
+    } else {
+        for (size_t i=0;i<frames;i++) {
+            for (size_t c=0;c<channels;c++) samples[i*channels + c] *= gains[i];
+        }
+    }
+    for (size_t i=0;i<frames;i++) block_lowest = min(block_lowest, gains[i]);
+
+    float current = lowest_gain.load(memory_order_relaxed);
+    while (block_lowest < current && !lowest_gain.compare_exchange_weak(current, block_lowest, memory_order_relaxed));
+}
+
+float limiter::collect_reduction() {
+    return -20*log10(lowest_gain.exchange(1, memory_order_relaxed));
+}
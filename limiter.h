@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Lookahead peak limiter on the float mix.
+// The gain needed by each sample is held over the lookahead window, released back
+// towards unity, then averaged over the window : the gain ramps down ahead of a peak and
+// every sample leaves at most at the ceiling, without clipping. The output is delayed by
+// latency() frames. Channels are interleaved and share the gain, the stereo image holds.
+// The audio thread processes blocks, one other thread reads the meter.
+class limiter {
+public:
+    // ceiling is the largest absolute sample let through, lookahead and release in seconds
+    limiter(unsigned int rate, unsigned int channels = 1, float ceiling = 1, float lookahead = 0.005f, float release = 0.1f);
+
+    // Limits frames frames in place, channels samples each
+    void process(float* samples, size_t frames);
+
+    // frames the output lags the input
+    size_t latency() const { return window - 1; }
+
+    // Largest gain reduction since the previous call, in dB (0 when the limiter did nothing)
+    float collect_reduction();
+
+private:
+    unsigned int channels;
+    float ceiling;
+    size_t window;              // lookahead in frames
+    float release_coef;         // per sample, of the distance to unity gain
+
+    std::vector<float> delay;   // last window input frames, circular
+    std::vector<float> box;     // last window released gains, circular
+    size_t cursor = 0;          // next slot of delay and box
+    double box_sum;
+    double inverse_window;
+    float released = 1;         // held gain released towards unity
+
+    // sliding minimum of the needed gains, increasing from front to back, circular
+    std::vector<float> queue_gain;
+    std::vector<uint64_t> queue_time;
+    size_t queue_front = 0, queue_size = 0;
+    uint64_t time = 0;          // input frames processed
+
+    std::vector<float> gains;   // per block scratch
+
+    std::atomic<float> lowest_gain{1};
+};
@@ -0,0 +1,47 @@
+#include "load_meter.h"
+#include <algorithm>
+
+using namespace std;
+
+void load_meter::record(double load, int voices) {
+    int bin = min(bins - 1, (int)(load/bin_width));
+    histogram[bin].fetch_add(1, memory_order_relaxed);
+
+    uint64_t packed = ((uint64_t)(load*1000) << 32) | (uint32_t)voices;
+    uint64_t current = worst.load(memory_order_relaxed);
+    while (packed > current && !worst.compare_exchange_weak(current, packed, memory_order_relaxed));
+}
+
+load_meter::stats load_meter::collect() {
+    stats s;
+    uint64_t counts[bins];
+    for (int i=0;i<bins;i++) {
+        uint64_t total = histogram[i].load(memory_order_relaxed);
+        counts[i] = total - previous[i];
+        previous[i] = total;
+        s.periods += counts[i];
+    }
+    uint64_t w = worst.exchange(0, memory_order_relaxed);
+    s.max = (w >> 32)/1000.0;
+    s.max_voices = (int)(w & 0xFFFFFFFF);
+    if (s.periods == 0) return s;
+
+    // percentiles at the upper edge of their bin
+    uint64_t seen = 0;
+    bool p50_found = false;
+    for (int i=0;i<bins;i++) {
+        seen += counts[i];
+        if (!p50_found && seen*2 >= s.periods) {
+            s.p50 = (i+1)*bin_width;
+            p50_found = true;
+        }
+        if (seen*100 >= s.periods*99) {
+            s.p99 = (i+1)*bin_width;
+            break;
+        }
+    }
+    s.p50 = min(s.p50, s.max);
+    s.p99 = min(s.p99, s.max);
+    for (int i=(int)(1/bin_width);i<bins;i++) s.overruns += counts[i];
+    return s;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// DSP load of rendered periods, render time over period duration.
+// The audio thread records periods without locks, one other thread reads the statistics.
+class load_meter {
+public:
+    // Called after each period, load is 1 when rendering took the whole period
+    void record(double load, int voices);
+
+    struct stats {
+        uint64_t periods = 0;
+        uint64_t overruns = 0;  // periods that took longer than their duration
+        double p50 = 0;
+        double p99 = 0;
+        double max = 0;
+        int max_voices = 0;     // active voices during the worst period
+    };
+
+    // Statistics of the periods recorded since the previous call
+    stats collect();
+
+private:
+    // 0.5% steps up to 200%, the last bin holds everything above
+    static const int bins = 401;
+    static constexpr double bin_width = 0.005;
+
+    std::atomic<uint64_t> histogram[bins] = {};
+    // worst period, load in 1/1000 in the high bits and voices in the low bits
+    std::atomic<uint64_t> worst{0};
+    // histogram at the previous collect, reader side only
+    uint64_t previous[bins] = {};
+};
@@ -0,0 +1,41 @@
+#include "loopback.h"
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+void loopback_random_notes(RtMidiIn &midiin, const volatile sig_atomic_t &quit, float notes_per_second) {
+    // random intervals so arrivals fall anywhere in the audio periods
+    mt19937 gen(0);
+    exponential_distribution<double> interval(notes_per_second);
+    while (!quit) {
+        this_thread::sleep_for(chrono::duration<double>(interval(gen)));
+        unsigned char note_on[3] = {0x90, 69, 100};
+        midiin.injectMessage(note_on, 3);
+        this_thread::sleep_for(chrono::milliseconds(20));
+        unsigned char note_off[3] = {0x80, 69, 0};
+        midiin.injectMessage(note_off, 3);
+    }
+}
+
+size_t loopback_replay(RtMidiIn &midiin, const mid_sequence &events, float tempo, float speed,
+    const volatile sig_atomic_t &quit) {
+    size_t dropped = 0;
+    // events are due relative to the start, sleeping never accumulates drift
+    auto begin = chrono::steady_clock::now();
+    for (size_t i=0;i<events.size() && !quit;i++) {
+        auto &evt = events[i];
+        auto due = begin + chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<double>((60/tempo)*evt.timestamp/speed));
+        // wake up regularly so quit is noticed during long rests
+        while (!quit && chrono::steady_clock::now() < due)
+            this_thread::sleep_until(min(due, chrono::steady_clock::now() + chrono::milliseconds(100)));
+        if (quit) break;
+        unsigned char message[3] = {evt.status, evt.data1, evt.data2};
+        size_t size = (evt.status & 0xF0) == 0xC0 || (evt.status & 0xF0) == 0xD0 ? 2 : 3;
+        if (!midiin.injectMessage(message, size)) dropped++;
+    }
+    return dropped;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <csignal>
+#include "RtMidi.h"
+#include "mid_file.h"
+
+// Generators feeding an RtMidiIn opened on the RTMIDI_LOOPBACK api, so the whole
+// input path is exercised without a controller. Each one runs on its own thread
+// until quit is set, as a device would.
+
+// Plays a note at random times, notes_per_second on average, each released after 20ms
+void loopback_random_notes(RtMidiIn &midiin, const volatile sig_atomic_t &quit, float notes_per_second);
+
+// Plays events in real time at the given tempo, speed times faster.
+// Returns the number of messages the input dropped (queue full)
+size_t loopback_replay(RtMidiIn &midiin, const mid_sequence &events, float tempo, float speed,
+    const volatile sig_atomic_t &quit);
@@ -0,0 +1,288 @@
+#include "mid_file.h"
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// location of a MTrk chunk payload inside the file
+struct track_chunk {
+    size_t offset;
+    uint32_t length;
+};
+
+// decode one MTrk chunk, timestamps are accumulated from the start of the track
+static vector<midi_event> decode_track(const unsigned char* data, uint32_t length, short ppqn) {
+    vector<midi_event> midi_events;
+    size_t c = 0;
+
+    // variable length unpacking
+    auto readVarLen = [&]() {
+        int32_t len = 0;
+        bool first_byte = true;
+        while (first_byte && c < length) {
+            len *= 0x80;
+            first_byte = (data[c] & 0x80);
+            len += (data[c] & 0x7F);
+            c += 1;
+        }
+        return len;
+    };
+
+    // midi event timestamp accumulation
+    float timestamp = 0;
+
+    while (c < length) {
+        timestamp += readVarLen()/(float)ppqn; // add delta time from last event
+        if (c >= length) break;
+        unsigned char status = data[c++];
+        unsigned char stat4 = status>>4;
+        if (status == 0xFF) {
+            // NON MIDI EVENT
+            c += 1;
+            int32_t len = readVarLen();
+            c += len;
+        } else {
+            // MIDI EVENT
+            if (c + (stat4 == 0xC ? 1 : 2) > length) break;
+            midi_event evt = {timestamp, status, data[c], 0};
+            if (stat4 == 0xC) c += 1;
+            else {
+                evt.data2 = data[c+1];
+                c += 2;
+            }
+            midi_events.push_back(evt);
+        }
+    }
+    return midi_events;
+}
+
+// decode a whole mid file already read into memory, on up to threads threads
+static vector<midi_event> decode_mid_file(const vector<unsigned char> &file, size_t threads) {
+
+    // Check header
+    if (file.size() < 14 || memcmp(file.data(), "MThd\0\0\0\6", 8) != 0) throw "Not a valid MID file";
+    short ppqn = (file[12]<<8) | file[13];
+
+    // First pass : index chunk offsets
+    vector<track_chunk> tracks;
+    size_t pos = 14;
+    while (pos + 8 <= file.size()) {
+        const unsigned char* header = &file[pos];
+        uint32_t length = (header[4]<<24) | (header[5] << 16) | (header[6] << 8) | header[7];
+        pos += 8;
+        length = min<size_t>(length, file.size() - pos);
+        // Ignore non-MTrk chunks
+        if (memcmp(header, "MTrk", 4) == 0) tracks.push_back({pos, length});
+        pos += length;
+    }
+
+    // Second pass : decode tracks on a thread pool, each worker picks the next undecoded track
+    vector<vector<midi_event>> decoded(tracks.size());
+    atomic<size_t> next_track(0);
+    auto worker = [&]() {
+        for (size_t t = next_track++; t < tracks.size(); t = next_track++) {
+            decoded[t] = decode_track(&file[tracks[t].offset], tracks[t].length, ppqn);
+        }
+    };
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    size_t nthreads = min<size_t>(threads, tracks.size());
+    vector<thread> pool;
+    for (size_t i=1;i<nthreads;i++) pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool) t.join();
+
+    // Merge tracks (each already sorted) pairwise in ascending timestamp,
+    // on equal timestamps earlier tracks come first
+    auto earlier = [](const midi_event &a, const midi_event &b){
+        return a.timestamp < b.timestamp;};
+    while (decoded.size() > 1) {
+        vector<vector<midi_event>> merged;
+        for (size_t i=0;i+1<decoded.size();i+=2) {
+            auto &a = decoded[i];
+            auto &b = decoded[i+1];
+            vector<midi_event> m(a.size() + b.size());
+            merge(a.begin(), a.end(), b.begin(), b.end(), m.begin(), earlier);
+            merged.push_back(move(m));
+        }
+        if (decoded.size() % 2) merged.push_back(move(decoded.back()));
+        decoded = move(merged);
+    }
+
+    if (decoded.empty()) return {};
+    return move(decoded[0]);
+}
+
+// Event cache
+// A cache file is a cache_header followed by the events as fixed-width midi_event
+// records. It is named after the hash of the mid file contents : editing a file gives it
+// another entry, identical files (copies, touched files) share one.
+struct cache_header {
+    char magic[8];
+    uint64_t hash;
+    uint64_t length; // of the mid file, guards against hash collisions
+    uint64_t count;
+};
+
+static const char cache_magic[8] = {'M', 'I', 'D', 'E', 'V', 'C', '2', '\0'};
+
+// FNV-1a
+static uint64_t hash_bytes(const vector<unsigned char> &data) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (auto b : data) {
+        h ^= b;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// map a cache file read-only, events are then used in place
+static bool map_cache(const string &path, uint64_t hash, uint64_t length, mid_sequence &seq) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cache_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    shared_ptr<const void> mapping(p, [size](const void* p){ munmap((void*)p, size); });
+
+    auto header = (const cache_header*)p;
+    if (memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header->hash != hash || header->length != length ||
+        sizeof(cache_header) + header->count*sizeof(midi_event) != size) return false;
+
+    seq.events = (const midi_event*)(header + 1);
+    seq.count = header->count;
+    seq.storage = mapping;
+    return true;
+}
+
+// write through a temporary file so concurrent readers never see a partial cache
+static void write_cache(const string &path, uint64_t hash, uint64_t length, const vector<midi_event> &events) {
+    string tmp = path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) return;
+    cache_header header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.hash = hash;
+    header.length = length;
+    header.count = events.size();
+    size_t data_size = events.size()*sizeof(midi_event);
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+        write(fd, events.data(), data_size) == (ssize_t)data_size;
+    // mkstemp creates it private, the cache may be shared between users
+    ok = ok && fchmod(fd, 0644) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) unlink(tmp.c_str());
+}
+
+mid_sequence make_sequence(vector<midi_event> events) {
+    auto owned = make_shared<const vector<midi_event>>(move(events));
+    mid_sequence seq;
+    seq.events = owned->data();
+    seq.count = owned->size();
+    seq.storage = owned;
+    return seq;
+}
+
+mid_sequence load_mid_file(string input_mid, string cache_dir, size_t threads) {
+
+    // Read the whole file, chunks are then decoded from memory
+    ifstream input(input_mid, ios::in | ios::binary);
+    vector<unsigned char> file((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+
+    if (cache_dir.empty()) return make_sequence(decode_mid_file(file, threads));
+
+    uint64_t hash = hash_bytes(file);
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.evc", (unsigned long long)hash);
+    string path = cache_dir + "/" + name;
+
+    mid_sequence seq;
+    if (map_cache(path, hash, file.size(), seq)) return seq;
+
+    auto events = decode_mid_file(file, threads);
+    write_cache(path, hash, file.size(), events);
+    return make_sequence(move(events));
+}
+
+// Seek index
+
+// tracks notes the same way the player does, sounding notes survive release while sustained
+struct note_tracker {
+    bool pressed[128] = {};
+    bool sounding[128] = {};
+    int count = 0;          // notes sounding
+    bool sustain_pedal = false;
+    unsigned char pan = 64;
+    float last_release = -INFINITY;
+    int channel;
+
+    void release(int key, float timestamp) {
+        sounding[key] = false;
+        count--;
+        last_release = timestamp;
+    }
+
+    void apply(const midi_event &evt) {
+        unsigned char type = evt.status & 0xF0;
+        if (channel != -1 && (evt.status & 0x0F) != channel) return;
+        int key = evt.data1 & 0x7F;
+        if (type == 0x90) {
+            if (!sounding[key]) count++;
+            pressed[key] = true;
+            sounding[key] = true;
+        } else if (type == 0x80) {
+            if (!sustain_pedal && sounding[key]) release(key, evt.timestamp);
+            pressed[key] = false;
+        } else if (type == 0xB0 && evt.data1 == 10) {
+            pan = evt.data2;
+        } else if (type == 0xB0 && evt.data1 == 64) {
+            if (evt.data2 == 127) {
+                sustain_pedal = true;
+            } else {
+                for (int k=0;k<128;k++) {
+                    if (!pressed[k] && sounding[k]) release(k, evt.timestamp);
+                }
+                sustain_pedal = false;
+            }
+        }
+    }
+};
+
+seek_index build_seek_index(const mid_sequence &events, int channel, float bucket) {
+    seek_index index = {bucket, {}};
+    note_tracker tracker;
+    tracker.channel = channel;
+    size_t c = 0;
+    float end = events.size() ? events[events.size()-1].timestamp : 0;
+    for (size_t b = 0; b*bucket <= end; b++) {
+        float timestamp = b*bucket;
+        while (c < events.size() && events[c].timestamp < timestamp) tracker.apply(events[c++]);
+        index.points.push_back({timestamp, c, tracker.sustain_pedal, tracker.count == 0, tracker.pan, tracker.last_release});
+    }
+    return index;
+}
+
+const seek_point& quiet_point(const seek_index &index, float timestamp, float tail) {
+    size_t b = min(index.points.size()-1, (size_t)(max(0.f, timestamp)/index.bucket));
+    for (; b > 0; b--) {
+        auto &p = index.points[b];
+        if (p.quiet && p.timestamp - p.last_release >= tail) break;
+    }
+    return index.points[b];
+}
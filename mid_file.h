@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cmath>
+
+// Mid file input
+// Fixed-width record, also the on-disk layout of the event cache
+struct midi_event {
+    float timestamp; // in beats from the start of the file
+    unsigned char status, data1, data2;
+};
+
+static_assert(sizeof(midi_event) == 8, "midi_event is stored as is in the event cache");
+
+// Events of a mid file, either decoded in memory or mapped from the event cache
+struct mid_sequence {
+    const midi_event* events = nullptr;
+    size_t count = 0;
+    std::shared_ptr<const void> storage; // keeps the decoded events or the mapping alive
+
+    size_t size() const { return count; }
+    const midi_event& operator[](size_t i) const { return events[i]; }
+};
+
+// Reads every MTrk chunk of a standard MIDI file and returns all midi events
+// merged in ascending timestamp order. Tracks are decoded in parallel on up to threads
+// threads (0 for one per core).
+// If cache_dir is set, decoded events are stored there and mapped directly on
+// later loads of the same file, skipping parsing entirely.
+// Throws a message if the file is not a valid mid file.
+mid_sequence load_mid_file(std::string input_mid, std::string cache_dir = "", size_t threads = 0);
+
+// Sequence owning events already in ascending timestamp order
+mid_sequence make_sequence(std::vector<midi_event> events);
+
+// Control state right before timestamp
+struct seek_point {
+    float timestamp;        // in beats
+    size_t cursor;          // first event at or after timestamp
+    bool sustain_pedal = false;
+    bool quiet = true;      // no note sounds, pressed or held by the pedal
+    unsigned char pan = 64;   // last CC10 value
+    // last time a sounding note was released, in beats : its release tail may still sound
+    float last_release = -INFINITY;
+};
+
+// One seek point every `bucket` beats, where playback can start over from a silent synth
+struct seek_index {
+    float bucket;           // in beats
+    std::vector<seek_point> points;
+};
+
+// Builds the seek index of a sequence, only events on channel (-1 for all) are considered
+seek_index build_seek_index(const mid_sequence &events, int channel, float bucket = 4);
+
+// Latest seek point at or before timestamp that is quiet and whose last release is at
+// least tail beats old : a synth playing the file is silent there. The first point always is.
+// The index must not be empty
+const seek_point& quiet_point(const seek_index &index, float timestamp, float tail);
@@ -0,0 +1,114 @@
+#include "render.h"
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+bool mid_player::feed(Synth &synth) {
+    if (cursor < events.size()) {
+        // math magic to convert midi timestamp to sample number
+        while (cursor < events.size() &&
+            (60/tempo)*events[cursor].timestamp <= (synth.position/(float)synth.rate)) {
+            auto msg = events[cursor++];
+            synth.process_message({msg.status, msg.data1, msg.data2});
+        }
+        // end of file, release notes left held
+        if (cursor == events.size()) synth.release_all();
+        return true;
+    }
+    return synth.active();
+}
+
+vector<int16_t> to_int16(const vector<float> &mix, float volume, dither_mode dithering, unsigned int channels) {
+    vector<int16_t> samples(mix.size());
+    ditherer(dithering, channels).convert(mix.data(), samples.data(), mix.size(), volume);
+    return samples;
+}
+
+// copy of engine, silent at position 0
+static Synth fresh_copy(const Synth &engine) {
+    Synth synth = engine;
+    synth.reset();
+    synth.position = 0;
+    return synth;
+}
+
+vector<float> render_mid(const mid_sequence &events, const Synth &engine) {
+    Synth synth = fresh_copy(engine);
+    // same period as the player so events land on the same samples
+    mid_player player = {events, synth.rate/100};
+    vector<float> out;
+    size_t period = player.frames*synth.channels;
+    while (player.feed(synth)) {
+        out.resize(out.size() + period);
+        synth.render(&out[out.size() - period], player.frames);
+    }
+    return out;
+}
+
+vector<float> render_mid_segmented(const mid_sequence &events, const Synth &engine, size_t segments,
+    size_t threads) {
+
+    // overlap-add frames straddle segment starts and are not part of snapshots
+    if (engine.spectral()) return render_mid(events, engine);
+
+    Synth synth = fresh_copy(engine);
+    const unsigned int rate = synth.rate;
+    mid_player player = {events, rate/100};
+    size_t period = player.frames*synth.channels;
+
+    // segment length in periods, from the position of the last event,
+    // the release tail goes to the last segment
+    float end = events.size() ? (60/player.tempo)*events[events.size()-1].timestamp : 0;
+    size_t periods = ceil(end*rate/player.frames) + 1;
+    size_t segment_periods = max<size_t>(1, (periods + segments - 1)/max<size_t>(1, segments));
+
+    // Control-only pre-pass : synth state and file cursor at each segment start
+    struct segment_start {
+        synth_snapshot state;
+        size_t cursor;
+    };
+    vector<segment_start> starts;
+    for (size_t p = 0; true; p++) {
+        // state before the events of the period, the segment applies them itself
+        if (p % segment_periods == 0) starts.push_back({synth.snapshot(), player.cursor});
+        if (!player.feed(synth)) {
+            if (p % segment_periods == 0) starts.pop_back();
+            break;
+        }
+        synth.advance(player.frames);
+    }
+
+    // Render segments on a thread pool, the last one runs until silence
+    vector<vector<float>> rendered(starts.size());
+    atomic<size_t> next_segment(0);
+    auto worker = [&]() {
+        flush_denormals();
+        for (size_t s = next_segment++; s < starts.size(); s = next_segment++) {
+            Synth segment_synth = fresh_copy(engine);
+            // segments already run in parallel, and a pool takes one caller at a time
+            segment_synth.workers = nullptr;
+            segment_synth.restore(starts[s].state);
+            mid_player segment_player = {events, player.frames};
+            segment_player.cursor = starts[s].cursor;
+            auto &out = rendered[s];
+            for (size_t p = 0; (s + 1 == starts.size() || p < segment_periods) && segment_player.feed(segment_synth); p++) {
+                out.resize(out.size() + period);
+                segment_synth.render(&out[out.size() - period], player.frames);
+            }
+        }
+    };
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    size_t nthreads = min<size_t>(threads, starts.size());
+    vector<thread> pool;
+    for (size_t i=1;i<nthreads;i++) pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool) t.join();
+
+    // Stitch
+    vector<float> out;
+    for (auto &r : rendered) out.insert(out.end(), r.begin(), r.end());
+    return out;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include "mid_file.h"
+#include "synth.h"
+#include "dither.h"
+
+// Offline rendering of mid files
+
+// Feeds a mid file to a synth period after period, the same way the player does
+struct mid_player {
+    const mid_sequence &events;
+    size_t frames;          // period length in samples
+    float tempo = 120.0;
+    size_t cursor = 0;      // next event
+
+    // Applies the events due at the synth position, notes still held at the end of the
+    // file are released. Returns false once the file is over and the synth silent
+    bool feed(Synth &synth);
+};
+
+// Converts a rendered mix to 16 bits samples, as the player does
+std::vector<int16_t> to_int16(const std::vector<float> &mix, float volume,
+    dither_mode dithering = dither_mode::off, unsigned int channels = 1);
+
+// Renders a whole mid file until the last note faded out, on a copy of engine : its
+// parameters (rate, tuning, channel, channels, instrument...) apply, rendering starts silent
+// at position 0. engine.channels samples per frame
+std::vector<float> render_mid(const mid_sequence &events, const Synth &engine);
+
+// Same render split in segments rendered in parallel on up to threads threads (0 for one
+// per core), bit-identical to render_mid. Segments render without engine.workers.
+// The spectral engine carries frames across segment starts, it renders serially as render_mid.
+// A control-only pre-pass snapshots the synth at each segment start.
+std::vector<float> render_mid_segmented(const mid_sequence &events, const Synth &engine, size_t segments,
+    size_t threads = 0);
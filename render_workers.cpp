@@ -0,0 +1,87 @@
+#include "render_workers.h"
+#include "synth.h"
+#include <chrono>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+using namespace std;
+
+// how long an idle worker keeps polling for the next run before sleeping, over two 10ms periods
+const auto spin_time = chrono::milliseconds(25);
+
+// sleeps while word holds value
+static void futex_wait(atomic<uint32_t> &word, uint32_t value) {
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+static void futex_wake_all(atomic<uint32_t> &word) {
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+render_workers::render_workers(size_t count) : shares(count + 1) {
+    for (size_t w=1;w<=count;w++) threads.emplace_back(&render_workers::worker, this, w);
+}
+
+render_workers::~render_workers() {
+    stop = true;
+    generation++;
+    futex_wake_all(generation);
+    for (auto &t : threads) t.join();
+}
+
+void render_workers::run(size_t count, const function<void(size_t)> &f) {
+    if (count == 0) return;
+    uint32_t gen = generation.load(memory_order_relaxed) + 1;
+    task = &f;
+    pending.store(count, memory_order_relaxed);
+    // contiguous shares, published before the new generation
+    size_t n = shares.size();
+    for (size_t s=0;s<n;s++) {
+        shares[s].next.store(((uint64_t)gen << 32) | (count*s/n), memory_order_relaxed);
+        shares[s].end.store(count*(s + 1)/n, memory_order_release);
+    }
+    generation.store(gen);
+    // only after the pool was left idle
+    if (sleepers.load() > 0) futex_wake_all(generation);
+
+    work(0, gen);
+    // the last tasks may still run on workers
+    while (pending.load(memory_order_acquire) > 0) this_thread::yield();
+}
+
+void render_workers::work(size_t self, uint32_t gen) {
+    size_t n = shares.size();
+    for (size_t k=0;k<n;k++) {
+        auto &s = shares[(self + k) % n];
+        uint64_t next = s.next.load(memory_order_acquire);
+        for (;;) {
+            if ((uint32_t)(next >> 32) != gen || (uint32_t)next >= s.end.load(memory_order_acquire)) break;
+            if (!s.next.compare_exchange_weak(next, next + 1, memory_order_acq_rel)) continue;
+            (*task)((uint32_t)next);
+            pending.fetch_sub(1, memory_order_release);
+            next = s.next.load(memory_order_acquire);
+        }
+    }
+}
+
+void render_workers::worker(size_t self) {
+    flush_denormals();
+    uint32_t seen = 0;
+    while (!stop) {
+        auto idle = chrono::steady_clock::now();
+        while (generation.load() == seen && !stop) {
+            if (chrono::steady_clock::now() - idle < spin_time) {
+                this_thread::yield();
+                continue;
+            }
+            // a run either sees the sleeper or stored its generation before the futex checks it
+            sleepers++;
+            futex_wait(generation, seen);
+            sleepers--;
+        }
+        seen = generation.load(memory_order_acquire);
+        work(self, seen);
+    }
+}
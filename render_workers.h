@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Worker threads running the tasks of a period alongside the calling (audio) thread.
+// Each thread takes tasks from its own share first, then steals from the others' shares.
+// Taking a task is a CAS on the share's counter, no lock is taken while tasks run.
+// Idle workers spin for longer than a period, so a pool in use never sleeps and a run takes no
+// lock nor system call. A pool left idle sleeps on a futex over the generation, only then does
+// the next run pay for a wake. A pool serves one caller at a time.
+class render_workers {
+public:
+    // threads workers besides the calling thread
+    explicit render_workers(size_t threads);
+    ~render_workers();
+
+    // Runs task(i) for every i in [0, count) and returns once all of them are done
+    void run(size_t count, const std::function<void(size_t)> &task);
+
+    // threads taking part in a run, the calling one included
+    size_t size() const { return shares.size(); }
+
+private:
+    // tasks [begin, end) of a thread, next is packed with the generation of the run
+    // so a worker late from a previous run never takes a task of the current one.
+    // A run stores next before end : a late worker seeing the new end fails its CAS on next
+    struct alignas(64) share {
+        std::atomic<uint64_t> next{0};
+        std::atomic<uint32_t> end{0};
+    };
+
+    // takes and runs tasks of generation gen, own share first
+    void work(size_t self, uint32_t gen);
+    void worker(size_t self);
+
+    std::vector<share> shares;
+    std::vector<std::thread> threads;
+    const std::function<void(size_t)>* task = nullptr;
+    std::atomic<uint32_t> generation{0};
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> stop{false};
+
+    // workers sleeping on generation, woken by the next run
+    std::atomic<int> sleepers{0};
+};
@@ -0,0 +1,122 @@
+#include "resampler.h"
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+using namespace std;
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k=1;k<64 && term > sum*1e-12;k++) {
+        term *= (x/(2*k))*(x/(2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+// partial sums in independent lanes, so the loop vectorizes
+static float dot(const float* a, const float* b, size_t n) {
+    float lanes[8] = {};
+    size_t j = 0;
+    for (;j+8<=n;j+=8) {
+        for (size_t k=0;k<8;k++) lanes[k] += a[j+k]*b[j+k];
+    }
+    float sum = 0;
+    for (;j<n;j++) sum += a[j]*b[j];
+    for (size_t k=0;k<8;k++) sum += lanes[k];
+    return sum;
+}
+
+resampler::resampler(unsigned int in_rate, unsigned int out_rate, unsigned int channels, size_t taps)
+    : channels(max(1u, channels)), taps(in_rate == out_rate ? 1 : max<size_t>(2, taps)) {
+    uint64_t g = gcd(in_rate, out_rate);
+    up = out_rate/g;
+    down = in_rate/g;
+
+    if (in_rate == out_rate) {
+        bank = {1.f};
+    } else {
+        // Kaiser window of beta 8, its transition band (5.1/taps of the input rate wide)
+        // ends at the lower Nyquist frequency
+        const double beta = 8;
+        double nyquist = min(in_rate, out_rate)/2.0;
+        double cutoff = max(nyquist/2, nyquist - 5.1/this->taps*in_rate/2);
+        // in cycles per sample of the prototype
+        double fc = cutoff/((double)up*in_rate);
+        size_t length = this->taps*up;
+        // taps/2 input frames, whole, so outputs land on the input grid
+        double center = length/2;
+        double norm = 1/bessel_i0(beta);
+        vector<double> prototype(length);
+        double sum = 0;
+        for (size_t i=0;i<length;i++) {
+            double t = i - center;
+            double x = 2*fc*t;
+            double sinc = x == 0 ? 1 : sin(M_PI*x)/(M_PI*x);
+            double r = t/center;
+            prototype[i] = 2*fc*sinc*bessel_i0(beta*sqrt(max(0.0, 1 - r*r)))*norm;
+            sum += prototype[i];
+        }
+        // unity gain at DC, each phase sums to about 1
+        bank.resize(length);
+        for (size_t p=0;p<up;p++) {
+            for (size_t j=0;j<this->taps;j++) {
+                bank[p*this->taps + j] = prototype[p + (this->taps - 1 - j)*up]*up/sum;
+            }
+        }
+    }
+
+    // silence before the first input, the first output is centered on the first input frame
+    pending_frames = this->taps - 1;
+    pending.assign(this->channels, vector<float>(pending_frames, 0.f));
+    base = pending_frames + latency();
+}
+
+size_t resampler::input_needed(size_t out_frames) const {
+    if (out_frames == 0) return 0;
+    size_t last = base + (phase + (out_frames - 1)*down)/up;
+    return last < pending_frames ? 0 : last + 1 - pending_frames;
+}
+
+void resampler::process(const float* in, size_t in_frames, float* out, size_t out_frames) {
+    // only grows, no allocation once the largest block went through
+    for (size_t c=0;c<channels;c++) {
+        auto &p = pending[c];
+        p.resize(pending_frames + in_frames);
+        for (size_t i=0;i<in_frames;i++) p[pending_frames + i] = in[i*channels + c];
+    }
+    pending_frames += in_frames;
+
+    for (size_t i=0;i<out_frames;i++) {
+        const float* coefs = &bank[phase*taps];
+        for (size_t c=0;c<channels;c++) out[i*channels + c] = dot(&pending[c][base + 1 - taps], coefs, taps);
+        phase += down;
+        base += phase/up;
+        phase %= up;
+    }
+
+    // keep the history of the next output onwards
+    size_t drop = base + 1 - taps;
+    for (auto &p : pending) {
+        memmove(p.data(), &p[drop], (pending_frames - drop)*sizeof(float));
+        p.resize(pending_frames - drop);
+    }
+    pending_frames -= drop;
+    base = taps - 1;
+}
+
+vector<float> resample(const vector<float> &samples, unsigned int in_rate, unsigned int out_rate, unsigned int channels) {
+    if (in_rate == out_rate) return samples;
+    channels = max(1u, channels);
+    resampler r(in_rate, out_rate, channels);
+    size_t in_frames = samples.size()/channels;
+    size_t out_frames = (in_frames*(uint64_t)out_rate + in_rate - 1)/in_rate;
+    // silence after the end for the filter tail
+    vector<float> in(samples);
+    in.resize(max(in_frames, r.input_needed(out_frames))*channels, 0.f);
+    vector<float> out(out_frames*channels);
+    r.process(in.data(), in.size()/channels, out.data(), out_frames);
+    return out;
+}
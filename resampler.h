@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Streaming sample rate converter from the engine rate to the device or file rate.
+// Polyphase windowed-sinc : the ratio is reduced to up/down (147/160 from 48kHz to 44.1kHz),
+// the lowpass prototype at up times the input rate is split in up phases of taps taps, and
+// each output sample is one phase dotted with the last taps input frames. The cutoff sits
+// under the lower of both Nyquist frequencies, images and aliases are about 80dB down.
+// Equal rates take a single unit tap, samples pass through untouched. Channels are interleaved.
+class resampler {
+public:
+    resampler(unsigned int in_rate, unsigned int out_rate, unsigned int channels = 1, size_t taps = 64);
+
+    // Input frames process() needs to produce out_frames frames, varies between calls
+    size_t input_needed(size_t out_frames) const;
+
+    // Consumes in_frames frames of in and writes out_frames frames to out. in_frames is
+    // at least input_needed(out_frames), frames beyond are kept for the next calls.
+    // Allocates nothing once the largest block has been seen
+    void process(const float* in, size_t in_frames, float* out, size_t out_frames);
+
+    // input frames the output lags the input : an output frame needs this many later ones
+    size_t latency() const { return taps/2; }
+
+private:
+    unsigned int channels;
+    size_t taps;
+    uint64_t up, down;
+
+    // phase p coefficients at bank[p*taps], oldest frame first
+    std::vector<float> bank;
+
+    // input frames still needed, one array per channel, the first taps - 1 ones are history
+    std::vector<std::vector<float>> pending;
+    size_t pending_frames;
+    size_t base;                // frame of pending the next output ends on
+    uint64_t phase = 0;         // of the next output, in 1/up of an input frame
+};
+
+// Converts a whole interleaved render, tail of the filter included
+std::vector<float> resample(const std::vector<float> &samples, unsigned int in_rate, unsigned int out_rate, unsigned int channels = 1);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free queue for one producer thread and one consumer thread.
+// Holds up to size-1 elements, push fails when full.
+template <typename T, size_t size>
+class spsc_queue {
+public:
+    bool push(const T &v) {
+        size_t w = write.load(std::memory_order_relaxed);
+        size_t next = (w + 1) % size;
+        if (next == read.load(std::memory_order_acquire)) return false;
+        items[w] = v;
+        write.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &v) {
+        size_t r = read.load(std::memory_order_relaxed);
+        if (r == write.load(std::memory_order_acquire)) return false;
+        v = items[r];
+        read.store((r + 1) % size, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[size];
+    std::atomic<size_t> write{0};
+    std::atomic<size_t> read{0};
+};
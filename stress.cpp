@@ -0,0 +1,130 @@
+#include "stress.h"
+#include "synth.h"
+#include "load_meter.h"
+#include "RtMidi.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+// periods timed at each polyphony step, 2s at 10ms periods
+const int step_periods = 200;
+
+// Messages of one period of a pattern with keys notes held
+struct stress_generator {
+    string pattern;
+    int keys;
+
+    bool has(const char* part) const { return pattern == part || pattern == "mixed"; }
+
+    void period(int p, vector<vector<unsigned char>> &out) const {
+        out.clear();
+        auto key = [&](int k) { return (unsigned char)(21 + k%88); };
+        if (p == 0) {
+            if (has("sustain")) out.push_back({0xB0, 64, 127});
+            for (int k=0;k<keys;k++) out.push_back({0x90, key(k), 100});
+            // only the pedal holds them from now on
+            if (has("sustain")) for (int k=0;k<keys;k++) out.push_back({0x80, key(k), 0});
+            return;
+        }
+        if (has("trill")) {
+            // two keys above the held ones alternating every period, 50 notes per second each
+            unsigned char a = key(keys), b = key(keys + 1);
+            if (p % 2) out.insert(out.end(), {{0x80, b, 0}, {0x90, a, 90}});
+            else out.insert(out.end(), {{0x80, a, 0}, {0x90, b, 90}});
+        }
+        if (has("controls")) {
+            // modulation, volume and expression sweeps, channel and polyphonic aftertouch
+            unsigned char v = (p*3) % 128;
+            for (int i=0;i<4;i++) {
+                out.push_back({0xB0, 1, v});
+                out.push_back({0xB0, 7, (unsigned char)(127 - v)});
+                out.push_back({0xB0, 11, v});
+                out.push_back({0xD0, v});
+            }
+            for (int k=0;k<min(keys, 16);k++) out.push_back({0xA0, key(p + k), v});
+        }
+        if (has("repeat")) {
+            // a held key struck again every period, without releasing it
+            if (keys > 0) out.push_back({0x90, key(p % keys), 110});
+        }
+    }
+};
+
+static const char* patterns[] = {"sustain", "trill", "controls", "repeat", "mixed"};
+
+static void stress_pattern(const string &pattern, const Synth &base, bool verbose) {
+    const unsigned int rate = base.rate;
+    const size_t frames = rate/100;
+    const double period_duration = frames/(double)rate;
+    float volume = 0.25;
+
+    int capacity = 0;
+    double capacity_load = 0;
+    bool exceeded = false;
+    if (verbose) cout << pattern << endl;
+    // held keys plus the trilled ones must fit on the keyboard
+    const int max_keys = 88 - (stress_generator{pattern, 0}.has("trill") ? 2 : 0);
+    for (int keys : {1, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88}) {
+        keys = min(keys, max_keys);
+
+        RtMidiIn midiin(RtMidi::RTMIDI_LOOPBACK, "Stress", 1024);
+        midiin.openPort(0);
+        midiin.ignoreTypes(false, false, false);
+        Synth synth = base;
+        vector<float> mix(frames);
+        vector<int16_t> buffer(frames);
+        stress_generator gen = {pattern, keys};
+        vector<vector<unsigned char>> messages;
+        vector<unsigned char> message;
+        load_meter meter;
+        size_t message_count = 0;
+
+        for (int p=0;p<step_periods;p++) {
+            // generated before the period begins, as a controller would have sent them
+            gen.period(p, messages);
+            for (auto &m : messages) midiin.injectMessage(m.data(), m.size());
+            message_count += messages.size();
+
+            auto period_begin = chrono::steady_clock::now();
+            for (midiin.getMessage(&message); !message.empty(); midiin.getMessage(&message))
+                synth.process_message(message);
+            synth.render(mix.data(), frames);
+            for (size_t i=0;i<frames;i++) buffer[i] = convert(mix[i], volume);
+            double render_time = chrono::duration<double>(chrono::steady_clock::now() - period_begin).count();
+            meter.record(render_time/period_duration, synth.voice_count());
+        }
+
+        auto s = meter.collect();
+        if (verbose) {
+            cout << "\t" << s.max_voices << " voices, " << message_count*100.f/step_periods
+                << " messages per second : p50 " << s.p50*100 << "%, p99 " << s.p99*100
+                << "%, max " << s.max*100 << "%, " << s.overruns << " overruns" << endl;
+        }
+        // more keys would only overrun further
+        if (s.p99 >= 1) {
+            exceeded = true;
+            break;
+        }
+        capacity = s.max_voices;
+        capacity_load = s.p99;
+        if (keys == max_keys) break;
+    }
+    cout << pattern << " : " << capacity << " voices sustainable (p99 load " << capacity_load*100 << "%)"
+        << (exceeded ? "" : ", keyboard exhausted before the period budget") << endl;
+}
+
+int run_stress(const string &pattern, const Synth &synth, bool verbose) {
+    bool found = false;
+    cout << "Polyphony capacity at " << synth.rate << "Hz, " << synth.rate/100 << " frames per period, "
+        << synth.polyphony() << " voices at most" << endl;
+    for (auto p : patterns) {
+        if (pattern != "all" && pattern != p) continue;
+        found = true;
+        stress_pattern(p, synth, verbose);
+    }
+    if (!found) cout << "Unknown stress pattern " << pattern << endl;
+    return found ? 0 : 1;
+}
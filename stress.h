@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include "synth.h"
+
+// Polyphony capacity test
+// Drives a synth with pathological input patterns through the loopback midi input and
+// the same event, render and conversion path as the player, raising the number of held
+// keys step by step. Each step is timed period by period against the period duration,
+// the ramp stops at the first step whose p99 period time exceeds it.
+// pattern is "sustain" (every key held by the pedal), "trill" (fast alternating notes),
+// "controls" (dense CC and aftertouch streams), "repeat" (repeated note-ons on held keys),
+// "mixed" (all of them at once) or "all" to run each one.
+// Prints the load of each step with verbose and, per pattern, the maximum sustainable
+// polyphony. Returns 1 on an unknown pattern.
+// Each step plays on a copy of synth, with its parameters and polyphony.
+int run_stress(const std::string &pattern, const Synth &synth, bool verbose);
@@ -0,0 +1,881 @@
+#include "synth.h"
+#include "render_workers.h"
+#include "fft.h"
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+float t_freq(int64_t t, float freq, unsigned int rate) {
+    return fmod((float)t*freq/rate,1.f);
+}
+
+float square_wave(float t) {
+    return t<0.5?1:-1;
+}
+
+float sine_wave(float t) {
+    return sin(2*t*M_PI);
+}
+
+float saw_wave(float t) {
+    return t*2-1;
+}
+
+float triangle_wave(float t) {
+    return t<0.5?t*4-1:3-t*4;
+}
+
+// PolyBLEP and PolyBLAMP residuals : two samples polynomial corrections around a
+// discontinuity of the waveform (BLEP) or of its slope (BLAMP) at t = 0, dt being the
+// phase step per sample. They remove most of the aliasing of the naive waveforms.
+static inline float poly_blep(float t, float dt) {
+    if (t < dt) {
+        t /= dt;
+        return t+t - t*t - 1;
+    } else if (t > 1 - dt) {
+        t = (t - 1)/dt;
+        return t*t + t+t + 1;
+    }
+    return 0;
+}
+
+static inline float poly_blamp(float t, float dt) {
+    if (t < dt) {
+        t = t/dt - 1;
+        return -1/3.f*t*t*t;
+    } else if (t > 1 - dt) {
+        t = (t - 1)/dt + 1;
+        return 1/3.f*t*t*t;
+    }
+    return 0;
+}
+
+float polyblep_square(float t, float dt) {
+    float t2 = t + 0.5f;
+    if (t2 >= 1) t2 -= 1;
+    return square_wave(t) + poly_blep(t, dt) - poly_blep(t2, dt);
+}
+
+float polyblep_saw(float t, float dt) {
+    return saw_wave(t) - poly_blep(t, dt);
+}
+
+float polyblamp_triangle(float t, float dt) {
+    float t2 = t + 0.5f;
+    if (t2 >= 1) t2 -= 1;
+    // slope jumps by 8 per turn at both corners
+    return triangle_wave(t) + 4*dt*(poly_blamp(t, dt) - poly_blamp(t2, dt));
+}
+
+void flush_denormals(bool enable) {
+#if defined(__SSE__)
+    // FTZ (bit 15) and DAZ (bit 6) of MXCSR
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(enable ? csr | 0x8040 : csr & ~0x8040u);
+#elif defined(__aarch64__)
+    // FZ, bit 24 of FPCR, covers both inputs and outputs
+    uint64_t fpcr;
+    asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+    fpcr = enable ? fpcr | (1ull << 24) : fpcr & ~(1ull << 24);
+    asm volatile("msr fpcr, %0" : : "r"(fpcr));
+#endif
+}
+
+#ifdef SYNTH_FIXED_POINT
+// The mix is Q15 (exact in float), volume and scale are applied in integer and saturated
+int16_t convert(float s, float volume) {
+    int64_t q = (int64_t)(s*32768);
+    int64_t v = (q*(int64_t)lrintf(volume*32768)) >> 15;
+    v = (v*0x7FFE) >> 15;
+    return v > 0x7FFE ? 0x7FFE : v < -0x7FFE ? -0x7FFE : v;
+}
+#else
+int16_t convert(float s, float volume) {
+    return (min(1.f, max(-1.f,s*volume)))*0x7FFE;
+}
+#endif
+
+vector<float> gen_keyboard(float tuning) {
+    vector<float> keyboard(88);
+    // A0 freq
+    const float a0 = tuning/16.0;
+    for (size_t i=0;i<keyboard.size();i++) {
+        keyboard[i] = a0*pow(2.0, (float)i/12.0);
+    }
+    return keyboard;
+}
+
+int keyboard_note_index(const char* s) {
+    int len = strlen(s);
+    if (len == 3 && (tolower(s[1])!='b'&&s[1]!='#')) throw "malformed note";
+    int mod = (len==2)?0:(s[1]=='#'?1:-1);
+
+    char note = toupper(s[0]);
+    char oct = (len==2)?s[1]:s[2];
+    if (note < 'A' || note > 'G') throw "bad note";
+    if (oct  < '0' || oct  > '7') throw "bad octave";
+    vector<int> note_map = {0, 2, 3, 5, 7, 8, 10};
+    int index = note_map[(note-'A')] + mod + (oct - '0')*12;
+    if (index < 0 || index >= 88) throw "bad range";
+    return index;
+}
+
+// Partial amplitudes of an instrument, partial i at i times the root frequency
+template <size_t N>
+struct harmonic_set {
+    float amp[N];
+
+    // sum of the partials is at most 1
+    constexpr float weight() const {
+        float w = 0.0;
+        for (auto a : amp) w += a;
+        return 1.0/w;
+    }
+};
+
+constexpr harmonic_set<6> organ_harmonics = {{1.0, 0.3, 0.8, 0.14, 0.64, 0.5}};
+constexpr harmonic_set<1> single_harmonic = {{1.0}};
+constexpr harmonic_set<9> clarinet_harmonics = {{1.0, 0, 0.75, 0, 0.5, 0, 0.14, 0, 0.5}};
+constexpr harmonic_set<8> strings_harmonics = {{1.0, 0.5, 0.33, 0.25, 0.2, 0.17, 0.14, 0.12}};
+// 1/k partials, a band-limited saw
+constexpr auto bright_harmonics = []() {
+    harmonic_set<32> h = {};
+    for (size_t k=0;k<32;k++) h.amp[k] = 1.f/(k+1);
+    return h;
+}();
+// struck string, partials fading with rank and every 7th one missing (hammer at 1/7 of the string)
+constexpr auto piano_harmonics = []() {
+    harmonic_set<64> h = {};
+    for (size_t k=0;k<64;k++) h.amp[k] = (k+1)%7 ? (1 - k/64.f)/(k+1) : 0;
+    return h;
+}();
+
+// one sample of a waveform summed over a harmonic set, everything known at compile time
+// is folded : partials are unrolled, silent ones skipped
+template <float (*Wave)(float), const auto &H>
+static inline float partials(float t) {
+    constexpr size_t n = sizeof(H.amp)/sizeof(H.amp[0]);
+    constexpr float weight = H.weight();
+    float val = 0.0;
+    for (size_t i=1;i<=n;i++) {
+        if (H.amp[i-1] != 0) val += Wave(fmod(t*i, 1.f))*H.amp[i-1]*weight;
+    }
+    return val;
+}
+
+float synth_sound(float t) {
+    return partials<sine_wave, organ_harmonics>(t);
+}
+
+float velocity_curve(char v) {
+    return pow((float)v / 127.f, 0.5f);
+}
+
+// phase step of a 32 bits accumulator
+static uint32_t phase_increment(float freq, unsigned int rate) {
+    return (uint32_t)(uint64_t)llround(freq/(double)rate*4294967296.0);
+}
+
+static const float phase_scale = 1.f/4294967296.f;
+
+// Voice kernel : adds n samples of a voice to out, from the given phase and
+// envelope countdown. One instantiation per instrument, no dispatch per sample
+typedef void (*voice_kernel)(bus_sample* out, int32_t n, uint32_t phase, uint32_t increment,
+    float target, float slope, int32_t remaining, float velocity);
+
+template <float (*Wave)(float), const auto &H>
+static void render_kernel(float* out, int32_t n, uint32_t phase, uint32_t increment,
+    float target, float slope, int32_t remaining, float velocity) {
+    for (int32_t i=0;i<n;i++) {
+        out[i] += (target - slope*remaining)*velocity*partials<Wave, H>(phase*phase_scale);
+        phase += increment;
+        remaining--;
+    }
+}
+
+// band-limited waveforms depend on the phase step, a single partial is played
+template <float (*Wave)(float, float)>
+static void render_band_limited(float* out, int32_t n, uint32_t phase, uint32_t increment,
+    float target, float slope, int32_t remaining, float velocity) {
+    const float dt = increment*phase_scale;
+    for (int32_t i=0;i<n;i++) {
+        out[i] += (target - slope*remaining)*velocity*Wave(phase*phase_scale, dt);
+        phase += increment;
+        remaining--;
+    }
+}
+
+// Sine partials by the Chebyshev recurrence sin((k+1)x) = 2cos(x)sin(kx) - sin((k-1)x),
+// one sin/cos pair per sample whatever the number of partials.
+// Partials at or above Nyquist are left out instead of aliasing
+template <const auto &H>
+static void render_recurrence(float* out, int32_t n, uint32_t phase, uint32_t increment,
+    float target, float slope, int32_t remaining, float velocity) {
+    constexpr size_t partials = sizeof(H.amp)/sizeof(H.amp[0]);
+    constexpr float weight = H.weight();
+    const float dt = increment*phase_scale;
+    size_t audible = partials;
+    while (audible > 0 && audible*dt >= 0.5f) audible--;
+    for (int32_t i=0;i<n;i++) {
+        float x = 2*(float)M_PI*(phase*phase_scale);
+        float c2 = 2*cosf(x);
+        float previous = 0, current = sinf(x);
+        float val = 0;
+        for (size_t k=0;k<audible;k++) {
+            val += H.amp[k]*current;
+            float next = c2*current - previous;
+            previous = current;
+            current = next;
+        }
+        out[i] += (target - slope*remaining)*velocity*(val*weight);
+        phase += increment;
+        remaining--;
+    }
+}
+
+#ifdef SYNTH_FIXED_POINT
+// Integer waveforms, Q15 from a 32 bits phase
+
+// 4096 steps of a turn and one more for interpolation
+static const vector<int16_t> sine_table = []() {
+    vector<int16_t> table(4097);
+    for (size_t i=0;i<table.size();i++) table[i] = lrint(sin(2*M_PI*i/4096)*32767);
+    return table;
+}();
+
+// table read with linear interpolation over the next 15 bits of phase
+static inline int32_t fixed_sine(uint32_t phase) {
+    uint32_t i = phase >> 20;
+    int32_t frac = (phase >> 5) & 0x7FFF;
+    int32_t a = sine_table[i];
+    return a + (((sine_table[i+1] - a)*frac) >> 15);
+}
+
+static inline int32_t fixed_square(uint32_t phase) {
+    return phase < 0x80000000u ? 32767 : -32767;
+}
+
+static inline int32_t fixed_saw(uint32_t phase) {
+    return (int32_t)(phase - 0x80000000u) >> 16;
+}
+
+static inline int32_t fixed_triangle(uint32_t phase) {
+    int32_t p = phase >> 16;
+    return min(32767, p < 0x8000 ? 2*p - 32768 : 98304 - 2*p);
+}
+
+// partial amplitudes times the weight of the set, Q15
+template <const auto &H>
+struct fixed_harmonics {
+    static constexpr size_t count = sizeof(H.amp)/sizeof(H.amp[0]);
+    int32_t amp[count] = {};
+    constexpr fixed_harmonics() {
+        for (size_t k=0;k<count;k++) amp[k] = (int32_t)(H.amp[k]*H.weight()*32768 + 0.5f);
+    }
+};
+
+// Integer kernel : oscillator in Q15, envelope times velocity in Q31 stepped once per
+// sample, voice samples added to a Q15 bus. Float only enters once per stage run
+template <int32_t (*Wave)(uint32_t), const auto &H>
+static void render_fixed(int32_t* out, int32_t n, uint32_t phase, uint32_t increment,
+    float target, float slope, int32_t remaining, float velocity) {
+    static constexpr fixed_harmonics<H> q15;
+    int64_t level = llround((double)(target - slope*remaining)*velocity*2147483648.0);
+    const int64_t step = llround((double)slope*velocity*2147483648.0);
+    for (int32_t i=0;i<n;i++) {
+        int32_t val = 0;
+        for (size_t k=0;k<q15.count;k++) {
+            if (q15.amp[k] != 0) val += (Wave(phase*(uint32_t)(k+1))*q15.amp[k]) >> 15;
+        }
+        out[i] += (int32_t)((val*level + (1ll << 30)) >> 31);
+        level += step;
+        phase += increment;
+    }
+}
+#endif
+
+// sine partials of an instrument, read at runtime by the spectral engine
+struct partial_table {
+    const float* amp = nullptr;
+    size_t count = 0;
+    float weight = 0;
+};
+
+template <const auto &H>
+static constexpr partial_table table_of() {
+    return {H.amp, sizeof(H.amp)/sizeof(H.amp[0]), H.weight()};
+}
+
+struct instrument {
+    const char* name;
+    voice_kernel kernel;
+    voice_kernel band_limited; // kernel used with band_limited set, if the naive one aliases
+    voice_kernel recurrence;   // kernel of the recurrence additive engine, sine based instruments
+    partial_table partials;    // partials of the spectral engine, sine based instruments
+};
+
+#ifdef SYNTH_FIXED_POINT
+// integer kernels only, the band-limited and additive engines are float
+static const instrument instruments[] = {
+    {"organ", render_fixed<fixed_sine, organ_harmonics>, nullptr, nullptr, {}},
+    {"sine", render_fixed<fixed_sine, single_harmonic>, nullptr, nullptr, {}},
+    {"square", render_fixed<fixed_square, single_harmonic>, nullptr, nullptr, {}},
+    {"saw", render_fixed<fixed_saw, single_harmonic>, nullptr, nullptr, {}},
+    {"triangle", render_fixed<fixed_triangle, single_harmonic>, nullptr, nullptr, {}},
+    {"clarinet", render_fixed<fixed_sine, clarinet_harmonics>, nullptr, nullptr, {}},
+    {"strings", render_fixed<fixed_sine, strings_harmonics>, nullptr, nullptr, {}},
+    {"bright", render_fixed<fixed_sine, bright_harmonics>, nullptr, nullptr, {}},
+    {"piano", render_fixed<fixed_sine, piano_harmonics>, nullptr, nullptr, {}},
+};
+#else
+static const instrument instruments[] = {
+    {"organ", render_kernel<sine_wave, organ_harmonics>, nullptr, render_recurrence<organ_harmonics>, table_of<organ_harmonics>()},
+    {"sine", render_kernel<sine_wave, single_harmonic>, nullptr, render_recurrence<single_harmonic>, table_of<single_harmonic>()},
+    {"square", render_kernel<square_wave, single_harmonic>, render_band_limited<polyblep_square>, nullptr, {}},
+    {"saw", render_kernel<saw_wave, single_harmonic>, render_band_limited<polyblep_saw>, nullptr, {}},
+    {"triangle", render_kernel<triangle_wave, single_harmonic>, render_band_limited<polyblamp_triangle>, nullptr, {}},
+    {"clarinet", render_kernel<sine_wave, clarinet_harmonics>, nullptr, render_recurrence<clarinet_harmonics>, table_of<clarinet_harmonics>()},
+    {"strings", render_kernel<sine_wave, strings_harmonics>, nullptr, render_recurrence<strings_harmonics>, table_of<strings_harmonics>()},
+    {"bright", render_kernel<sine_wave, bright_harmonics>, nullptr, render_recurrence<bright_harmonics>, table_of<bright_harmonics>()},
+    {"piano", render_kernel<sine_wave, piano_harmonics>, nullptr, render_recurrence<piano_harmonics>, table_of<piano_harmonics>()},
+};
+#endif
+
+int instrument_count() {
+    return sizeof(instruments)/sizeof(instruments[0]);
+}
+
+const char* instrument_name(int id) {
+    return id >= 0 && id < instrument_count() ? instruments[id].name : "";
+}
+
+int instrument_index(const char* name) {
+    for (int i=0;i<instrument_count();i++) {
+        if (strcmp(instruments[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int next_stage(int stage) {
+    if (stage == 1) return 2;
+    if (stage == 2) return 3;
+    return 0; // release and stolen end in silence
+}
+
+static void copy_voice(voice_bank &b, size_t from, size_t to) {
+    b.phase[to] = b.phase[from];
+    b.increment[to] = b.increment[from];
+    b.level[to] = b.level[from];
+    b.target[to] = b.target[from];
+    b.slope[to] = b.slope[from];
+    b.remaining[to] = b.remaining[from];
+    b.velocity[to] = b.velocity[from];
+    b.stage[to] = b.stage[from];
+    b.timestamp[to] = b.timestamp[from];
+    b.key[to] = b.key[from];
+    b.pressed[to] = b.pressed[from];
+}
+
+Synth::Synth(unsigned int rate, float tuning, int channel)
+    : rate(rate), channel(channel), kb(gen_keyboard(tuning)) {
+    set_polyphony(kb.size());
+}
+
+void Synth::set_polyphony(size_t max_voices) {
+    pool_size = min(kb.size(), max<size_t>(1, max_voices));
+    voices = voice_bank();
+    sustain_pedal = false;
+}
+
+size_t Synth::polyphony() const {
+    return pool_size;
+}
+
+int Synth::find_voice(int key) const {
+    for (size_t v=0;v<pool_size;v++) {
+        if (voices.stage[v] > 0 && voices.key[v] == key) return v;
+    }
+    return -1;
+}
+
+int Synth::allocate_voice(int key) {
+    // a key prefers the voice of its own index, with one voice per key every
+    // key then always plays on the same voice
+    int v = key % pool_size;
+    if (voices.stage[v] > 0) {
+        v = -1;
+        for (size_t i=0;i<pool_size && v<0;i++) {
+            if (voices.stage[i] == 0) v = i;
+        }
+    }
+    if (v < 0) {
+        // steal, ties go to the lowest voice
+        auto rank = [&](size_t i) {
+            // lower is stolen first
+            if (stealing == steal_policy::quietest) return make_pair(0, (double)voices.level[i]*voices.velocity[i]);
+            int group = 0;
+            if (stealing == steal_policy::released_first)
+                group = voices.pressed[i] ? 2 : (voices.stage[i] == 4 ? 0 : 1);
+            return make_pair(group, (double)voices.timestamp[i]);
+        };
+        v = 0;
+        for (size_t i=1;i<pool_size;i++) {
+            if (rank(i) < rank(v)) v = i;
+        }
+        // the stolen voice fades out in a steal slot, replacing the quietest one if all are busy
+        size_t slot = pool_size;
+        for (size_t i=pool_size;i<lanes();i++) {
+            if (voices.stage[i] == 0) {
+                slot = i;
+                break;
+            }
+            if (voices.level[i] < voices.level[slot]) slot = i;
+        }
+        copy_voice(voices, v, slot);
+        enter_stage(slot, 5);
+        voices.stage[v] = 0;
+        voices.level[v] = 0;
+        voices.pressed[v] = false;
+    }
+    voices.key[v] = key;
+    voices.increment[v] = phase_increment(kb[key], rate);
+    return v;
+}
+
+void Synth::enter_stage(size_t v, int stage) {
+    for (;;) {
+        voices.stage[v] = stage;
+        if (stage == 0 || stage == 3) {
+            // constant level
+            voices.level[v] = voices.target[v] = stage == 3 ? sustain_level : 0;
+            voices.slope[v] = 0;
+            voices.remaining[v] = stage == 3 ? INT32_MAX : 0;
+            return;
+        }
+        float target = 0, slope = 0;
+        if (stage == 1) {
+            target = 1;
+            slope = 1.0/(attack_time*rate);
+        } else if (stage == 2) {
+            target = sustain_level;
+            slope = -(1.0-sustain_level)/(decay_time*rate);
+        } else if (stage == 4) {
+            slope = -sustain_level/(release_time*rate);
+        } else if (stage == 5) {
+            // short fade from any level, no click when a voice is stolen
+            slope = -1.0/(steal_time*rate);
+        }
+        double steps = slope != 0 ? ceil((target - voices.level[v])/slope) : 0;
+        if (steps > 0) {
+            // the level is snapped by less than a step so the stage ends exactly on target
+            voices.remaining[v] = (int32_t)min<double>(steps, INT32_MAX - 1);
+            voices.target[v] = target;
+            voices.slope[v] = slope;
+            voices.level[v] = target - slope*voices.remaining[v];
+            return;
+        }
+        stage = next_stage(stage);
+    }
+}
+
+void Synth::step_voice(size_t v, int32_t frames) {
+    voices.phase[v] += voices.increment[v]*(uint32_t)frames;
+    if (voices.stage[v] == 3) return;
+    voices.remaining[v] -= frames;
+    voices.level[v] = voices.target[v] - voices.slope[v]*voices.remaining[v];
+    if (voices.remaining[v] == 0) enter_stage(v, next_stage(voices.stage[v]));
+}
+
+void Synth::process_message(const vector<unsigned char> &message) {
+    if (message.size() != 3) return;
+    bool controller = message[0] == (0xB0 + channel) || (channel==-1 && (message[0]&0xF0)==0xB0);
+    if (controller && message[1] == 10) {
+        // Pan, 64 is the center
+        pan = max(-1.f, (message[2] - 64)/63.f);
+        return;
+    }
+    int key = message[1] - 21;
+    if (key < 0 || key >= (int)kb.size()) return;
+    if ((message[0] == 0x90+channel) || (channel==-1 && (message[0]&0xF0)==0x90)) {
+        int v = find_voice(key);
+        if (v < 0) v = allocate_voice(key);
+        // if quick pressed or sustain dont restart the oscillator
+        if (voices.stage[v] == 0) {
+            voices.timestamp[v] = position;
+            voices.phase[v] = 0;
+        }
+        voices.pressed[v] = true;
+        voices.velocity[v] = velocity_curve(message[2]);
+        enter_stage(v, 1); // set attack
+    }
+    else if (message[0] == 0x80+channel || (channel==-1 && (message[0]&0xF0)==0x80)) {
+        int v = find_voice(key);
+        if (v < 0) return;
+        if (!sustain_pedal) {
+            enter_stage(v, 4); // set release
+        }
+        voices.pressed[v] = false;
+    }
+    else if (controller && message[1] == 64) {
+        // Sustain
+        if (message[2] == 127) {
+            sustain_pedal = true;
+        } else {
+            // release all notes not pressed
+            for (size_t v=0;v<pool_size;v++) {
+                if (!voices.pressed[v] && voices.stage[v] > 0 && voices.stage[v] != 4) enter_stage(v, 4);
+            }
+            sustain_pedal = false;
+        }
+    }
+}
+
+void Synth::render_voice(size_t v, bus_sample* out, size_t frames) {
+    voice_kernel kernel = instruments[instrument].kernel;
+    if (band_limited && instruments[instrument].band_limited) kernel = instruments[instrument].band_limited;
+    if (additive == additive_engine::recurrence && instruments[instrument].recurrence)
+        kernel = instruments[instrument].recurrence;
+    size_t done = 0;
+    while (done < frames && voices.stage[v] > 0) {
+        // run up to the next stage change, the envelope is linear over it
+        // (constant on sustain, where the slope is 0)
+        int32_t n = min<size_t>(frames - done, voices.stage[v] == 3 ? INT32_MAX : voices.remaining[v]);
+        kernel(out + done, n, voices.phase[v], voices.increment[v],
+            voices.target[v], voices.slope[v], voices.remaining[v], voices.velocity[v]);
+        step_voice(v, n);
+        done += n;
+    }
+}
+
+#ifdef SYNTH_FIXED_POINT
+static void add_scaled(int32_t* out, const int32_t* in, float gain, size_t n) {
+    int64_t g = lrintf(gain*32768);
+    for (size_t i=0;i<n;i++) out[i] += (int32_t)((in[i]*g + (1 << 14)) >> 15);
+}
+#else
+static void add_scaled(float* out, const float* in, float gain, size_t n) {
+    for (size_t i=0;i<n;i++) out[i] += in[i]*gain;
+}
+#endif
+
+void Synth::voice_gains(size_t v, float &left, float &right) const {
+    float position = stereo_spread*(voices.key[v]/87.f*2 - 1) + pan;
+    float angle = (min(1.f, max(-1.f, position)) + 1)*(float)M_PI/4;
+    left = cos(angle);
+    right = sin(angle);
+}
+
+bool Synth::render_group(size_t g, size_t frames) {
+    bus_sample* bus = &buses[g*frames*bus_width()];
+    bool used = false;
+    for (size_t v=g*group_lanes;v<min(lanes(), (g+1)*group_lanes);v++) {
+        if (voices.stage[v] == 0) continue;
+        if (!used) fill(bus, bus + frames*channels, 0);
+        used = true;
+        if (channels == 1) {
+            render_voice(v, bus, frames);
+            continue;
+        }
+        // the voice is rendered once, then split to both sides
+        float left, right;
+        voice_gains(v, left, right);
+        bus_sample* voice = bus + 2*frames;
+        fill(voice, voice + frames, 0);
+        render_voice(v, voice, frames);
+        add_scaled(bus, voice, left, frames);
+        add_scaled(bus + frames, voice, right, frames);
+    }
+    return used;
+}
+
+bool Synth::spectral() const {
+    return additive == additive_engine::spectral && instruments[instrument].partials.count;
+}
+
+void Synth::render(float* out, size_t frames) {
+    if (spectral()) {
+        render_spectral(out, frames);
+        return;
+    }
+    size_t groups = (lanes() + group_lanes - 1)/group_lanes;
+    // only grows, no allocation once the engine has rendered its largest period
+    if (buses.size() < groups*frames*bus_width()) buses.resize(groups*frames*bus_width());
+    bus_used.resize(groups);
+
+    if (workers && voice_count() >= parallel_voices) {
+        workers->run(groups, [&](size_t g) { bus_used[g] = render_group(g, frames); });
+    } else {
+        for (size_t g=0;g<groups;g++) bus_used[g] = render_group(g, frames);
+    }
+
+    fill(out, out + frames*channels, 0.f);
+    for (size_t g=0;g<groups;g++) {
+        if (!bus_used[g]) continue;
+        const bus_sample* bus = &buses[g*frames*bus_width()];
+        if (channels == 1) {
+            for (size_t i=0;i<frames;i++) out[i] += bus[i];
+        } else {
+            for (size_t i=0;i<frames;i++) {
+                out[2*i] += bus[i];
+                out[2*i+1] += bus[frames + i];
+            }
+        }
+    }
+#ifdef SYNTH_FIXED_POINT
+    // Q15 buses, their sums are exact in float up to 2^24
+    for (size_t i=0;i<frames*channels;i++) out[i] *= 1.f/32768;
+#endif
+    position += frames;
+}
+
+// Spectral additive engine, after Rodet and Depalle's FFT^-1.
+// A frame of spectral_frame samples is a sum of Hann windowed sinusoids, frames overlap by
+// half (Hann windows at that hop sum to 1) so each one only needs the amplitude and phase
+// of every partial at its center. A windowed sinusoid is a few bins of the window transform
+// around its frequency, added to the spectrum of the frame in place of the whole signal.
+// Partials are complex exponentials, the frame is the real part of the inverse transform.
+static const int spectral_kernel_bins = 8; // bins of the window transform kept each side, sidelobes beyond are below -60dB
+
+// Hann window transform d bins away from its center, over the frame size
+// (a continuous approximation, within 1e-5 for the few bins used)
+static inline float hann_transform(float d, float sin_pi_d) {
+    if (fabs(fabs(d) - 1) < 1e-4f) return 0.25f;
+    if (fabs(d) < 1e-4f) return 0.5f;
+    return 0.5f*sin_pi_d/((float)M_PI*d*(1 - d*d));
+}
+
+void Synth::synthesize_frame() {
+    const size_t hop = spectral_frame/2;
+    const partial_table &p = instruments[instrument].partials;
+    for (size_t ch=0;ch<channels;ch++) fill(spectra[ch].begin(), spectra[ch].end(), complex<float>(0));
+    for (size_t v=0;v<lanes();v++) {
+        if (voices.stage[v] == 0) continue;
+        float gains[2] = {1, 0};
+        if (channels == 2) voice_gains(v, gains[0], gains[1]);
+        // the frame covers the next spectral_frame samples, centered a hop ahead
+        uint32_t center = voices.phase[v] + voices.increment[v]*(uint32_t)hop;
+        // envelope at the center too, clamped to the end of the current stage
+        float level = voices.level[v];
+        if (voices.stage[v] != 3) level = voices.target[v] - voices.slope[v]*max<int32_t>(0, voices.remaining[v] - (int32_t)hop);
+        float amplitude = level*voices.velocity[v]*p.weight;
+        float bin_step = voices.increment[v]*phase_scale*spectral_frame;
+        for (size_t k=0;k<p.count;k++) {
+            if (p.amp[k] == 0) continue;
+            // phase in turns, partial k+1 turns k+1 times faster
+            float turns = (uint32_t)(center*(k+1))*phase_scale;
+            float bin = bin_step*(k+1);
+            if (bin >= spectral_frame/2) break; // at or above Nyquist
+            // sin is the real part of exp(i*(x - pi/2))
+            complex<float> a = polar(amplitude*p.amp[k], 2*(float)M_PI*turns - (float)M_PI/2);
+            int first = (int)floor(bin) - spectral_kernel_bins + 1;
+            float sin_pi_bin = sin((float)M_PI*(bin - floor(bin)));
+            for (int m=first;m<first + 2*spectral_kernel_bins;m++) {
+                // sin(pi*(bin - m)) alternates in sign from one bin to the next
+                float s = (((int)floor(bin) - m) & 1) ? -sin_pi_bin : sin_pi_bin;
+                complex<float> w = a*hann_transform(bin - m, s);
+                for (size_t ch=0;ch<channels;ch++) spectra[ch][m & (spectral_frame - 1)] += w*gains[ch];
+            }
+        }
+    }
+    for (size_t ch=0;ch<channels;ch++) {
+        fft(spectra[ch], true);
+        // frame sample n is the inverse transform at n - spectral_frame/2
+        float* o = &overlap[ch*spectral_frame];
+        for (size_t n=0;n<spectral_frame;n++) o[n] += spectra[ch][(n + hop) & (spectral_frame - 1)].real();
+    }
+}
+
+void Synth::render_spectral(float* out, size_t frames) {
+    const size_t hop = spectral_frame/2;
+    // one overlap-add buffer per channel, one after the other
+    if (overlap.size() != spectral_frame*channels) {
+        overlap.assign(spectral_frame*channels, 0);
+        for (size_t ch=0;ch<channels;ch++) spectra[ch].resize(spectral_frame);
+        overlap_ready = 0;
+    }
+    size_t done = 0;
+    while (done < frames) {
+        if (overlap_ready == 0) {
+            synthesize_frame();
+            overlap_ready = hop;
+        }
+        size_t n = min(frames - done, overlap_ready);
+        for (size_t ch=0;ch<channels;ch++) {
+            const float* o = &overlap[ch*spectral_frame + hop - overlap_ready];
+            for (size_t i=0;i<n;i++) out[(done + i)*channels + ch] = o[i];
+        }
+        overlap_ready -= n;
+        done += n;
+        advance(n);
+        if (overlap_ready == 0) {
+            // the first half is out, the second one waits for the next frame
+            for (size_t ch=0;ch<channels;ch++) {
+                auto o = overlap.begin() + ch*spectral_frame;
+                copy(o + hop, o + spectral_frame, o);
+                fill(o + hop, o + spectral_frame, 0.f);
+            }
+        }
+    }
+}
+
+// a where mask (0 or 1) is set, b elsewhere, in integer operations : unlike a float
+// select, they vectorize
+static inline float select_float(int32_t mask, float a, float b) {
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    int32_t r = (ia & -mask) | (ib & ~-mask);
+    float f;
+    memcpy(&f, &r, sizeof(f));
+    return f;
+}
+
+void Synth::advance(size_t frames) {
+    // Lanes staying in their stage over the whole block, most of them, move in one branch-free
+    // pass across the arrays that vectorizes. Spare lanes are silent and left as they are
+    alignas(32) int32_t crossing[voice_bank::capacity];
+    const int32_t step = min<size_t>(frames, INT32_MAX);
+    for (size_t v=0;v<voice_bank::capacity;v++) {
+        // masks combined with & and |, short-circuits would branch
+        int32_t stage = voices.stage[v];
+        int32_t sustain = stage == 3;
+        int32_t within = sustain | ((stage > 0) & (voices.remaining[v] > step));
+        int32_t moving = within & !sustain;
+        voices.phase[v] += voices.increment[v]*(uint32_t)frames & -(uint32_t)within;
+        int32_t remaining = voices.remaining[v] - (step & -moving);
+        voices.remaining[v] = remaining;
+        float level = voices.target[v] - voices.slope[v]*remaining;
+        voices.level[v] = select_float(moving, level, voices.level[v]);
+        crossing[v] = (stage > 0) & !within;
+    }
+    // the others jump from one stage change to the next
+    for (size_t v=0;v<lanes();v++) {
+        if (!crossing[v]) continue;
+        size_t left = frames;
+        while (left > 0 && voices.stage[v] > 0) {
+            int32_t n = min<size_t>(left, voices.stage[v] == 3 ? INT32_MAX : voices.remaining[v]);
+            step_voice(v, n);
+            left -= n;
+        }
+    }
+    position += frames;
+}
+
+synth_snapshot Synth::snapshot() const {
+    return {position, sustain_pedal, pan, pool_size, voices};
+}
+
+void Synth::restore(const synth_snapshot &s) {
+    if (s.polyphony != pool_size) throw "snapshot does not match voice pool";
+    position = s.position;
+    sustain_pedal = s.sustain_pedal;
+    pan = s.pan;
+    voices = s.voices;
+}
+
+void Synth::release_all() {
+    for (size_t v=0;v<pool_size;v++) {
+        voices.pressed[v] = false;
+        if (voices.stage[v] > 0 && voices.stage[v] != 4) enter_stage(v, 4);
+    }
+    sustain_pedal = false;
+}
+
+void Synth::reset() {
+    voices = voice_bank();
+    overlap.clear();
+    sustain_pedal = false;
+    pan = 0;
+}
+
+bool Synth::active() const {
+    for (size_t v=0;v<lanes();v++) {
+        if (voices.stage[v] > 0) return true;
+    }
+    return false;
+}
+
+int Synth::voice_count() const {
+    int count = 0;
+    for (size_t v=0;v<lanes();v++) count += voices.stage[v] > 0;
+    return count;
+}
+
+// Snapshot serialization : fields one after the other in native byte order
+
+template <typename T>
+static void put(vector<unsigned char> &data, T v) {
+    auto p = (const unsigned char*)&v;
+    data.insert(data.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+static T get(const vector<unsigned char> &data, size_t &c) {
+    if (c + sizeof(T) > data.size()) throw "truncated snapshot";
+    T v;
+    memcpy(&v, &data[c], sizeof(T));
+    c += sizeof(T);
+    return v;
+}
+
+vector<unsigned char> synth_snapshot::serialize() const {
+    vector<unsigned char> data;
+    put<int64_t>(data, position);
+    put<uint8_t>(data, sustain_pedal);
+    put<float>(data, pan);
+    put<uint32_t>(data, polyphony);
+    for (size_t v=0;v<polyphony + Synth::steal_slots;v++) {
+        put<uint32_t>(data, voices.phase[v]);
+        put<uint32_t>(data, voices.increment[v]);
+        put<float>(data, voices.level[v]);
+        put<float>(data, voices.target[v]);
+        put<float>(data, voices.slope[v]);
+        put<int32_t>(data, voices.remaining[v]);
+        put<float>(data, voices.velocity[v]);
+        put<int32_t>(data, voices.stage[v]);
+        put<int64_t>(data, voices.timestamp[v]);
+        put<uint8_t>(data, voices.key[v]);
+        put<uint8_t>(data, voices.pressed[v]);
+    }
+    return data;
+}
+
+synth_snapshot synth_snapshot::deserialize(const vector<unsigned char> &data) {
+    synth_snapshot s;
+    size_t c = 0;
+    s.position = get<int64_t>(data, c);
+    s.sustain_pedal = get<uint8_t>(data, c);
+    s.pan = get<float>(data, c);
+    s.polyphony = get<uint32_t>(data, c);
+    if (s.polyphony < 1 || s.polyphony + Synth::steal_slots > voice_bank::capacity) throw "malformed snapshot";
+    for (size_t v=0;v<s.polyphony + Synth::steal_slots;v++) {
+        s.voices.phase[v] = get<uint32_t>(data, c);
+        s.voices.increment[v] = get<uint32_t>(data, c);
+        s.voices.level[v] = get<float>(data, c);
+        s.voices.target[v] = get<float>(data, c);
+        s.voices.slope[v] = get<float>(data, c);
+        s.voices.remaining[v] = get<int32_t>(data, c);
+        s.voices.velocity[v] = get<float>(data, c);
+        s.voices.stage[v] = get<int32_t>(data, c);
+        s.voices.timestamp[v] = get<int64_t>(data, c);
+        s.voices.key[v] = get<uint8_t>(data, c);
+        s.voices.pressed[v] = get<uint8_t>(data, c);
+        int32_t stage = s.voices.stage[v];
+        if (s.voices.key[v] >= 88 || stage < 0 || stage > 5) throw "malformed snapshot";
+        // a moving stage counts down to its end, a sounding voice advances : otherwise it
+        // would sound forever
+        bool moving = stage > 0 && stage != 3;
+        if ((moving && s.voices.remaining[v] <= 0) || (stage > 0 && s.voices.increment[v] == 0)) throw "malformed snapshot";
+        if (!isfinite(s.voices.level[v]) || !isfinite(s.voices.target[v]) || !isfinite(s.voices.slope[v]) ||
+            !isfinite(s.voices.velocity[v])) throw "malformed snapshot";
+    }
+    if (c != data.size()) throw "malformed snapshot";
+    return s;
+}
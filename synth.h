@@ -0,0 +1,238 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <complex>
+
+class render_workers;
+
+// Voices are mixed in float, or in Q15 integers (1.0 is 32768) when built with
+// SYNTH_FIXED_POINT (make FIXED=1) for targets with slow floating point.
+// The rendered mix is float either way
+#ifdef SYNTH_FIXED_POINT
+typedef int32_t bus_sample;
+#else
+typedef float bus_sample;
+#endif
+
+// Cute audio stuff
+float t_freq(int64_t t, float freq, unsigned int rate);
+float square_wave(float t);
+float sine_wave(float t);
+float saw_wave(float t);
+float triangle_wave(float t);
+int16_t convert(float s, float volume);
+
+// Flushes denormal floats to zero (FTZ/DAZ) on the calling thread, or stops doing so.
+// Decaying signals otherwise end in denormals, many times slower to compute on x86 :
+// every thread rendering audio calls it before its first sample
+void flush_denormals(bool enable = true);
+
+// Band-limited square, saw and triangle, dt is the phase step per sample (frequency/rate)
+float polyblep_square(float t, float dt);
+float polyblep_saw(float t, float dt);
+float polyblamp_triangle(float t, float dt);
+
+// build each root frequency of each note on a keyboard
+std::vector<float> gen_keyboard(float tuning);
+
+// get keyboard note index from literals like "A#5", "Gb2", "E4" ...
+int keyboard_note_index(const char* s);
+
+float synth_sound(float t);
+
+// Instruments a synth can play, each one a waveform and a set of harmonics
+// rendered by its own compile-time specialized kernel. Id 0, "organ", is synth_sound
+int instrument_count();
+const char* instrument_name(int id);
+// -1 if there is no instrument of that name
+int instrument_index(const char* name);
+float velocity_curve(char v);
+
+// Voice state as structure of arrays, one lane per voice, so envelope and oscillator
+// updates run on contiguous aligned arrays, across voices as well as across samples.
+// The envelope level is a function of the stage countdown, level = target - slope*remaining,
+// and the phase a 32 bits accumulator : a voice can jump any number of samples at once and
+// land exactly where sample by sample stepping would.
+struct voice_bank {
+    // 88 voices and 8 steal slots, a multiple of the SIMD width
+    static const size_t capacity = 96;
+
+    alignas(32) uint32_t phase[capacity] = {};     // oscillator phase, 2^32 is a full turn
+    alignas(32) uint32_t increment[capacity] = {}; // phase step per sample
+    alignas(32) float level[capacity] = {};        // envelope level of the next sample
+    alignas(32) float target[capacity] = {};       // level at the end of the stage
+    alignas(32) float slope[capacity] = {};        // level step per sample
+    alignas(32) int32_t remaining[capacity] = {};  // samples left in the stage
+    alignas(32) float velocity[capacity] = {};
+    alignas(32) int32_t stage[capacity] = {};      // 0 no sound, 1 attack, 2 decay, 3 sustain, 4 release, 5 stolen
+
+    // control state, not read by rendering
+    int64_t timestamp[capacity] = {};              // position of the press
+    uint8_t key[capacity] = {};                    // keyboard index
+    bool pressed[capacity] = {};
+};
+
+// how instruments made of sine partials sum them
+enum class additive_engine {
+    direct,     // one sin() per partial and sample
+    recurrence, // Chebyshev recurrence from one sin/cos pair per sample, cost linear in partials
+    spectral,   // every voice's partials in a shared spectrum, inverse FFT and overlap-add,
+                // cost per sample about constant in partials. Amplitudes are taken once a half
+                // frame and crossfaded, notes start and stop over that long
+};
+
+// which voice a note takes when every voice is busy
+enum class steal_policy {
+    oldest,         // pressed first
+    quietest,       // lowest current level
+    released_first, // oldest released note, then oldest held only by the pedal, then oldest
+};
+
+// Voice state of an engine at some position. Parameters (rate, tuning, envelope) are
+// not part of it, a snapshot is restored into an engine built with the same ones.
+struct synth_snapshot {
+    int64_t position = 0;
+    bool sustain_pedal = false;
+    float pan = 0;
+    size_t polyphony = 0;
+    voice_bank voices;
+
+    std::vector<unsigned char> serialize() const;
+    // throws a message on malformed data, voice states that could never end included
+    static synth_snapshot deserialize(const std::vector<unsigned char> &data);
+};
+
+// Synth engine : a keyboard of voices with its own parameters, sample rate and clock.
+// Engines share no state, any number of them can run in the same process.
+class Synth {
+public:
+    Synth(unsigned int rate = 48000, float tuning = 440, int channel = -1);
+
+    // Applies a 3 bytes midi message, effective from the next rendered sample
+    void process_message(const std::vector<unsigned char> &message);
+
+    // Renders frames frames of the mix into out, channels samples each (interleaved),
+    // and advances the clock.
+    // Voices are rendered by groups of group_lanes lanes, each into its own bus, and buses
+    // are summed in group order : the mix is the same whether groups run on workers or not
+    void render(float* out, size_t frames);
+
+    // Advances the clock exactly as render() would, updating envelopes only.
+    // Much cheaper than rendering, used to compute the state at a later position
+    void advance(size_t frames);
+
+    // Saves and restores the whole voice state, rendering after a restore is
+    // bit-identical to rendering from the engine the snapshot was taken from,
+    // unless spectral() : frames in progress are not part of snapshots
+    synth_snapshot snapshot() const;
+    void restore(const synth_snapshot &s);
+
+    // Releases every note and the pedal, as the end of a piece would
+    void release_all();
+
+    // Silences every voice at once
+    void reset();
+
+    // True when render() runs the spectral engine, the instrument has sine partials
+    bool spectral() const;
+
+    // False once every voice has faded out
+    bool active() const;
+
+    // Number of voices producing sound
+    int voice_count() const;
+
+    // Limits the voices sounding at once to max_voices (88 by default and at most, one per key).
+    // A note played while all of them are busy steals one according to stealing, which
+    // fades out over steal_time. Silences every voice
+    void set_polyphony(size_t max_voices);
+    size_t polyphony() const;
+
+    unsigned int rate;
+    int channel; // midi channel listened to, -1 for all
+
+    // ADSR envelope, times in seconds
+    float attack_time = 0.02f;
+    float decay_time = 0.3f;
+    float sustain_level = 0.6f;
+    float release_time = 0.05f;
+
+    // 1 for mono, 2 for interleaved stereo. A voice is rendered once and split to both
+    // sides with a constant-power pan, from its key spread over the keyboard and the
+    // channel pan (CC10)
+    unsigned int channels = 1;
+    float stereo_spread = 0.5f; // pan of the highest key, the lowest one is opposite
+    float pan = 0;              // -1 left to 1 right
+
+    // instrument id, see instrument_name()
+    int instrument = 0;
+    // plays the PolyBLEP/PolyBLAMP waveforms of instruments based on square, saw or triangle
+    bool band_limited = false;
+    additive_engine additive = additive_engine::direct;
+
+    // voice stealing
+    steal_policy stealing = steal_policy::oldest;
+    float steal_time = 0.005f;
+
+    // Renders voice groups on workers once at least parallel_voices voices sound,
+    // fewer are not worth waking them. A pool serves one engine at a time, copies rendering
+    // alongside need their own or none
+    render_workers* workers = nullptr;
+    int parallel_voices = 16;
+
+    // clock, sample number of the next rendered sample
+    int64_t position = 0;
+
+    // root frequency of each key
+    const std::vector<float> kb;
+
+    // voice pool, polyphony() voices followed by steal_slots fading stolen voices,
+    // so rendering never costs more than polyphony() + steal_slots voices
+    static const size_t steal_slots = 8;
+    voice_bank voices;
+
+    // global sustain pedal state
+    bool sustain_pedal = false;
+
+private:
+    // starts a stage of the ADSR pattern from the current level of voice v,
+    // skipping stages already complete
+    void enter_stage(size_t v, int stage);
+    // voice v jumps frames samples, frames never beyond the end of its stage
+    void step_voice(size_t v, int32_t frames);
+    // lanes in use, pool and steal slots
+    size_t lanes() const { return pool_size + steal_slots; }
+
+    // renders frames samples of voice v, added to out
+    void render_voice(size_t v, bus_sample* out, size_t frames);
+    // renders the voices of group g into its bus, false if none sounds
+    bool render_group(size_t g, size_t frames);
+
+    // left and right gains of voice v
+    void voice_gains(size_t v, float &left, float &right) const;
+    // samples of a group bus per frame : the mix, or left, right and the voice being split
+    size_t bus_width() const { return channels == 2 ? 3 : 1; }
+
+    static const size_t group_lanes = 8;
+    std::vector<bus_sample> buses;
+    std::vector<char> bus_used;
+
+    // spectral engine, frames of spectral_frame samples (a power of two) every half frame.
+    // The overlap-add buffer is not part of snapshots
+    void render_spectral(float* out, size_t frames);
+    // adds the next frame to overlap, from the voice state at the current position
+    void synthesize_frame();
+    static const size_t spectral_frame = 1024;
+    std::vector<std::complex<float>> spectra[2]; // one per channel
+    std::vector<float> overlap;
+    size_t overlap_ready = 0; // samples of overlap complete, the next ones to output
+
+    // pool voice playing key, -1 if none
+    int find_voice(int key) const;
+    // free pool voice for key, stealing one if needed
+    int allocate_voice(int key);
+
+    size_t pool_size;
+};
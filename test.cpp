@@ -7,17 +7,30 @@
 #include <fstream>
 #include <csignal>
 #include <thread>
+#include <chrono>
 #include <map>
 #include <functional>
 #include <algorithm>
+#include <memory>
 
 #include "RtMidi.h"
 #include "process_args.h"
+#include "mid_file.h"
+#include "synth.h"
+#include "wav.h"
+#include "batch.h"
+#include "golden.h"
+#include "load_meter.h"
+#include "latency.h"
+#include "loopback.h"
+#include "stress.h"
+#include "render_workers.h"
+#include "limiter.h"
+#include "dither.h"
+#include "resampler.h"
 
 #define PCM_DEVICE "default"
 
-unsigned int rate = 48000;
-
 using namespace std;
 
 void error(unsigned int e) {
@@ -27,207 +40,28 @@ void error(unsigned int e) {
     }
 }
 
-// Cute audio stuff
-
-float t_freq(int64_t t, float freq) {
-    return fmod((float)t*freq/rate,1.f);
-}
-
-float square_wave(float t) {
-    return t<0.5?1:-1;
-}
-
-float sine_wave(float t) {
-    return sin(2*t*M_PI);
-}
-
-float saw_wave(float t) {
-    return t*2-1;
-}
-
-float triangle_wave(float t) {
-    return t<0.5?t*4-1:3-t*4;
-}
-
-int16_t convert(float s, float volume) {
-    return (min(1.f, max(-1.f,s*volume)))*0x7FFE;
-}
-
-// build each root frequency of each note on a keyboard
-vector<float> gen_keyboard(float tuning) {
-    vector<float> keyboard(88);
-    // A0 freq
-    const float a0 = tuning/16.0;
-    for (size_t i=0;i<keyboard.size();i++) {
-        keyboard[i] = a0*pow(2.0, (float)i/12.0);
-    }
-    return keyboard;
-}
-
-// get keyboard note index from literals like "A#5", "Gb2", "E4" ...
-int keyboard_note_index(const char* s) {
-    int len = strlen(s);
-    if (len == 3 && (tolower(s[1])!='b'&&s[1]!='#')) throw "malformed note";
-    int mod = (len==2)?0:(s[1]=='#'?1:-1);
-
-    char note = toupper(s[0]);
-    char oct = (len==2)?s[1]:s[2];
-    if (note < 'A' || note > 'G') throw "bad note";
-    if (oct  < '0' || oct  > '7') throw "bad octave";
-    vector<int> note_map = {0, 2, 3, 5, 7, 8, 10};
-    int index = note_map[(note-'A')] + mod + (oct - '0')*12;
-    if (index < 0 || index >= 88) throw "bad range";
-    return index;
-}
-
-float synth_sound(float t) {
-    vector<float> harmonics = {1.0, 0.3,0.8,0.14,0.64, 0.5};
-
-    float weight = 0.0;
-    for (auto h : harmonics) weight += h;
-    weight = 1.0/weight;
-
-    float val = 0.0;
-    for (size_t i=1;i<=harmonics.size();i++) {
-        val += sine_wave(fmod(t*i, 1.f))*harmonics[i-1]*weight;
-    }
-
-    return val;
-}
-
-float velocity_curve(char v) {
-    return pow((float)v / 127.f, 0.5f);
-}
-
-// for file saving
-vector<int16_t> full_buffer;
-bool save = false;
-std::string save_filename = "";
-
-// verbose flag
-bool verbose = false;
-
-// Mid file input
-struct midi_event {
-    float timestamp;
-    unsigned char status, data1, data2;
-};
-
-vector<midi_event> load_mid_file(string input_mid) {
-
-    vector<midi_event> midi_events;
-
-    // Check header
-    ifstream input(input_mid, ios::in | ios::binary);
-    unsigned char header[14];
-    input.read((char*)header, 14);
-    if (strncmp((char*)header, "MThd\0\0\0\6", 8) != 0) {
-        cout << "Not a valid MID file " << header << endl;
-        exit(0);
-    }
-    short format   = (header[8 ]<<8) | header[9 ];
-    short ntracks  = (header[10]<<8) | header[11];
-    short ppqn = (header[12]<<8) | header[13];
-
-    // Read chunks
-    while (true) {
-        input.read((char*)header, 8);
-        if (input.eof()) break;
-        uint32_t length = (header[4]<<24) | (header[5] << 16) | (header[6] << 8) | header[7];
-        // Ignore non-MTrk chunks
-        if (strncmp((char*)header, "MTrk", 4) != 0) input.ignore(length);
-        vector<unsigned char> data(length);
-        input.read((char*)data.data(), length);
-        size_t c = 0;
-
-        // variable length unpacking
-        auto readVarLen = [&]() {
-            int32_t len = 0;
-            bool first_byte = true;
-            while (first_byte) {
-                len *= 0x80;
-                first_byte = (data[c] & 0x80);
-                len += (data[c] & 0x7F);
-                c += 1;
-            }
-            return len;
-        };
-
-        // midi event timestamp accumulation
-        float timestamp = 0;
-        
-        while (c < length) {
-            timestamp += readVarLen()/(float)ppqn; // add delta time from last event
-            unsigned char status = data[c++];
-            unsigned char stat4 = status>>4;
-            if (status == 0xFF) {
-                // NON MIDI EVENT
-                unsigned char status2 = data[c++];
-                int32_t len = readVarLen();
-                c += len;
-            } else {
-                // MIDI EVENT
-                midi_event evt = {timestamp, status, data[c], 0};
-                if (stat4 == 0xC) c += 1;
-                else {
-                    evt.data2 = data[c+1];
-                    c += 2;
-                }
-                midi_events.push_back(evt);
-            }
-        }
-    }
-
-    // sort in ascending timestamp
-    sort(midi_events.begin(), midi_events.end(), [](auto a, auto b){
-        return a.timestamp < b.timestamp;});
-    return midi_events;
-}
+// set on sigint, the playback loop then stops and saves the wav
+volatile sig_atomic_t quit = 0;
 
-// on sigint save wav
 void signalHandler(int signum) {
-
-    if (save) {
-        ofstream file(save_filename.c_str(), ios::out | ios::binary);
-
-        file << "RIFF";
-
-        int32_t file_size = full_buffer.size()*2 + 44;
-        int32_t fmt_len = 16;
-        int16_t fmt_type = 1;
-        int16_t fmt_channels = 1;
-        int32_t fmt_rate = 48000;
-        int32_t fmt_bits_per_sample = 16;
-        int32_t fmt_bytes_per_sample = fmt_bits_per_sample*fmt_channels/8;
-        int32_t fmt_bytes_sec = fmt_rate*fmt_bytes_per_sample;
-        int32_t data_size = full_buffer.size()*2;
-
-        file.write((char*)&file_size, sizeof(int32_t));
-        file << "WAVEfmt ";
-        file.write((char*)&fmt_len, sizeof(int32_t));
-        file.write((char*)&fmt_type, sizeof(int16_t));
-        file.write((char*)&fmt_channels, sizeof(int16_t));
-        file.write((char*)&fmt_rate, sizeof(int32_t));
-        file.write((char*)&fmt_bytes_sec, sizeof(int32_t));
-        file.write((char*)&fmt_bytes_per_sample, sizeof(int16_t));
-        file.write((char*)&fmt_bits_per_sample, sizeof(int16_t));
-        file << "data";
-        file.write((char*)&data_size, sizeof(int32_t));
-
-        file.write((char*)full_buffer.data(), full_buffer.size()*sizeof(int16_t));
-
-        file.flush();
-        if (verbose) cout << save_filename << " saved." << endl;
-    }
-
-    exit(0);
+    quit = 1;
 }
 
 int main(int argc, char ** argv) {
     signal(SIGINT, signalHandler);
+    // the player, golden and stress renders run on this thread
+    flush_denormals();
 
     int midi_port = 1;
 
+    // for file saving
+    vector<int16_t> full_buffer;
+    bool save = false;
+    std::string save_filename = "";
+
+    // verbose flag
+    bool verbose = false;
+
     // process options
     register_arg("port", "p", "set midi controller port", [&](auto s){
         midi_port = (int)atoi(s);
@@ -254,29 +88,255 @@ int main(int argc, char ** argv) {
         input = true;
     });
 
+    std::string cache_dir = "";
+    register_arg("cache", "", "keep decoded mid files in directory for faster reloads", [&](auto s) {
+        cache_dir = s;
+    });
+
     int channel = -1;
     register_arg("channel", "c", "read from midi channel (ALL, 0-15), whether from file or controller", [&](auto s) {
         if (strcmp(s, "ALL")==0) channel = -1;
         else channel = min(15, max(0, atoi(s)));
     });
 
+    float start = 0;
+    register_arg("start", "s", "start mid file playback at time in seconds", [&](auto s) {
+        start = max(0.f, (float)atof(s));
+    });
+
+    float end = -1;
+    register_arg("end", "e", "stop mid file playback at time in seconds", [&](auto s) {
+        end = atof(s);
+    });
+
+    bool loop_region = false;
+    register_arg("loop", "l", "loop mid file playback between start and end", [&](){
+        loop_region = true;
+    });
+
+    std::string batch_source = "";
+    bool batch = false;
+    register_arg("batch", "b", "render mid files of a directory or list file to wav on all cores, --output sets the wav directory", [&](auto s) {
+        batch_source = s;
+        batch = true;
+    });
+
+    size_t segments = 1;
+    register_arg("segments", "", "in batch mode, split each file in segments rendered in parallel", [&](auto s) {
+        segments = max(1, atoi(s));
+    });
+
+    std::string golden_dir = "";
+    bool golden = false;
+    register_arg("golden", "g", "compare offline renders of test sequences and mid files of a directory to its reference wavs or hashes, with the instrument, additive, band-limited and mono options", [&](auto s) {
+        golden_dir = s;
+        golden = true;
+    });
+
+    std::string tolerance = "exact";
+    register_arg("tolerance", "", "golden render tolerance : exact, maxabs:<error> or snr:<dB> (default exact)", [&](auto s) {
+        tolerance = s;
+    });
+
+    bool update_golden = false;
+    register_arg("update-golden", "", "write the golden reference wavs and hashes instead of comparing", [&](){
+        update_golden = true;
+    });
+
+    float stats_interval = 0;
+    register_arg("stats", "", "print DSP load statistics every given seconds (5s with --verbose)", [&](auto s) {
+        stats_interval = atof(s);
+    });
+
+    bool latency = false;
+    register_arg("latency", "", "measure note-on latency from midi input to audio output", [&](){
+        latency = true;
+    });
+
+    float loopback_notes = 0;
+    register_arg("latency-loopback", "", "measure latency on notes injected at the given rate per second instead of the controller", [&](auto s) {
+        loopback_notes = max(0.1f, (float)atof(s));
+        latency = true;
+    });
+
+    std::string loopback_mid = "";
+    register_arg("loopback", "", "play a mid file through the midi input path in-process instead of the controller", [&](auto s) {
+        loopback_mid = s;
+    });
+
+    float loopback_speed = 1;
+    register_arg("loopback-speed", "", "play the loopback mid file faster by the given factor (default 1)", [&](auto s) {
+        loopback_speed = max(0.01f, (float)atof(s));
+    });
+
+    size_t polyphony = 88;
+    register_arg("polyphony", "", "maximum number of voices sounding at once (default 88)", [&](auto s) {
+        polyphony = max(1, atoi(s));
+    });
+
+    steal_policy stealing = steal_policy::oldest;
+    register_arg("steal", "", "voice stolen when polyphony is exceeded : oldest, quietest or released (default oldest)", [&](auto s) {
+        if (strcmp(s, "quietest")==0) stealing = steal_policy::quietest;
+        else if (strcmp(s, "released")==0) stealing = steal_policy::released_first;
+        else stealing = steal_policy::oldest;
+    });
+
+    int instrument = 0;
+    register_arg("instrument", "", "instrument played : organ (default), sine, square, saw, triangle, clarinet, strings, bright or piano", [&](auto s) {
+        instrument = instrument_index(s);
+        if (instrument < 0) {
+            cout << "Unknown instrument " << s << endl;
+            exit(0);
+        }
+    });
+
+    bool band_limited = false;
+    register_arg("band-limited", "", "play square, saw and triangle instruments with band-limited (PolyBLEP) waveforms", [&](){
+        band_limited = true;
+    });
+
+    additive_engine additive = additive_engine::direct;
+    register_arg("additive", "", "additive engine of sine based instruments : direct (default), recurrence or spectral", [&](auto s) {
+        if (strcmp(s, "recurrence")==0) additive = additive_engine::recurrence;
+        else if (strcmp(s, "spectral")==0) additive = additive_engine::spectral;
+        else additive = additive_engine::direct;
+    });
+
+    size_t render_threads = 0;
+    register_arg("render-threads", "", "render voices on that many worker threads besides the audio thread (default 0)", [&](auto s) {
+        render_threads = max(0, atoi(s));
+    });
+
+    int parallel_voices = 16;
+    register_arg("parallel-voices", "", "voices sounding before rendering moves to the worker threads (default 16)", [&](auto s) {
+        parallel_voices = max(1, atoi(s));
+    });
+
+    // ouch owie my ears
+    float volume = 0.25;
+    register_arg("volume", "", "output volume, full scale at 1 (default 0.25)", [&](auto s) {
+        volume = max(0.f, (float)atof(s));
+    });
+
+    bool limit = false;
+    register_arg("limiter", "", "keep the output under full scale with a lookahead limiter instead of clipping", [&](){
+        limit = true;
+    });
+
+    // tpdf for wav files and off for ALSA unless set
+    std::string dither_option = "";
+    register_arg("dither", "", "dither of the 16 bits output : off, tpdf or shaped (default tpdf for wav files, off for ALSA)", [&](auto s) {
+        dither_option = s;
+    });
+    auto dither_or = [&](dither_mode unset) {
+        if (dither_option == "off") return dither_mode::off;
+        if (dither_option == "tpdf") return dither_mode::tpdf;
+        if (dither_option == "shaped") return dither_mode::shaped;
+        return unset;
+    };
+
+    bool mono = false;
+    register_arg("mono", "", "play and render in mono instead of stereo", [&](){
+        mono = true;
+    });
+
+    // the engine renders at its own rate, the output is resampled to the device or file rate
+    unsigned int engine_rate = 48000;
+    register_arg("rate", "", "sample rate the engine renders at (default 48000)", [&](auto s) {
+        engine_rate = max(8000, atoi(s));
+    });
+    unsigned int output_rate = 0;
+    register_arg("output-rate", "", "sample rate asked to ALSA and of batch wav files, resampled from the engine rate (default the engine rate)", [&](auto s) {
+        output_rate = max(8000, atoi(s));
+    });
+
+    std::string stress_pattern = "";
+    register_arg("stress", "", "measure polyphony capacity under a stress pattern (sustain, trill, controls, repeat, mixed or all), --verbose prints every step", [&](auto s) {
+        stress_pattern = s;
+    });
+
     process_args(argc, argv);
 
+    if (golden) {
+        // renders with the instrument, engine and channels options
+        Synth engine;
+        engine.instrument = instrument;
+        engine.band_limited = band_limited;
+        engine.additive = additive;
+        engine.channels = mono ? 1 : 2;
+        return check_golden(golden_dir, tolerance, update_golden, engine) ? 1 : 0;
+    }
+    // voice rendering workers of the synth
+    unique_ptr<render_workers> workers;
+    if (render_threads > 0) workers.reset(new render_workers(render_threads));
+
+    if (!stress_pattern.empty()) {
+        Synth synth(engine_rate, a4);
+        synth.set_polyphony(polyphony);
+        synth.stealing = stealing;
+        synth.instrument = instrument;
+        synth.band_limited = band_limited;
+        synth.additive = additive;
+        synth.workers = workers.get();
+        synth.parallel_voices = parallel_voices;
+        return run_stress(stress_pattern, synth, verbose);
+    }
+    if (batch) return render_batch(batch_source, save ? save_filename : "", a4, channel, cache_dir, segments,
+        dither_or(dither_mode::tpdf), mono ? 1 : 2, engine_rate, output_rate ? output_rate : engine_rate) ? 1 : 0;
+
     cout << "INFINITE PROGRAM : Ctrl-C to quit" << endl;
     cout << "If no note is registered, try changing the midi port with --port option" << endl;
 
     float tempo = 120.0;
     size_t mid_file_cursor = 0;
-    vector<midi_event> midi_events;
-    if (input) midi_events = load_mid_file(input_mid);
+    mid_sequence midi_events;
+    seek_index midi_seek_index;
+    if (input) {
+        try {
+            midi_events = load_mid_file(input_mid, cache_dir);
+        } catch (const char* e) {
+            cout << e << " " << input_mid << endl;
+            exit(0);
+        }
+        midi_seek_index = build_seek_index(midi_events, channel);
+        // loop over the whole file by default
+        if (loop_region && end < 0 && midi_events.size() > 0)
+            end = (60/tempo)*midi_events[midi_events.size()-1].timestamp;
+    }
+
+    mid_sequence loopback_events;
+    if (!loopback_mid.empty()) {
+        try {
+            loopback_events = load_mid_file(loopback_mid, cache_dir);
+        } catch (const char* e) {
+            cout << e << " " << loopback_mid << endl;
+            exit(0);
+        }
+    }
 
-    // Init midi controller
-    RtMidiIn midiin;
-    midiin.openPort(midi_port);
+    // Init midi controller, or the in-process input fed by a generator thread
+    bool use_loopback = loopback_notes > 0 || !loopback_mid.empty();
+    RtMidiIn midiin(use_loopback ? RtMidi::RTMIDI_LOOPBACK : RtMidi::UNSPECIFIED, "RtMidi Input Client", 1024);
+    midiin.openPort(use_loopback ? 0 : midi_port);
     midiin.ignoreTypes( false, false, false );
+    latency_probe probe;
+    probe.verbose = verbose;
+    // stamp messages as they arrive in the midi thread
+    if (latency) midiin.setCallback(&latency_midi_callback, &probe);
+
+    thread loopback;
+    size_t loopback_dropped = 0;
+    if (loopback_notes > 0) {
+        loopback = thread(loopback_random_notes, ref(midiin), cref(quit), loopback_notes);
+    } else if (use_loopback) {
+        loopback = thread([&]() {
+            loopback_dropped = loopback_replay(midiin, loopback_events, tempo, loopback_speed, quit);
+        });
+    }
 
-    // Initialize audio output
-    unsigned int channels = 1;
+    // Initialize audio output, the device may settle on another rate than asked
+    unsigned int rate = output_rate ? output_rate : engine_rate;
+    unsigned int channels = mono ? 1 : 2;
 
     snd_pcm_t *pcm_handle;
 
@@ -318,39 +378,127 @@ int main(int argc, char ** argv) {
         cout << "ALSA periods : " << periods << endl;
         cout << "ALSA period time : " << period_time << "us" << endl;
         cout << "ALSA buffer frames : " << frames << endl;
+        cout << "ALSA rate : " << rate << "Hz, engine rate : " << engine_rate << "Hz" << endl;
     }
 
     vector<int16_t> buffer(frames * channels);
 
-    // ouch owie my ears
-    float volume = 0.25;
-
-    const auto kb = gen_keyboard(a4);
-
-    // current keyboard state
-    struct key_state {
-        bool pressed = false;
-        int64_t timestamp = 0; // timestamp of last press
-        float vol = 0.0;
-        float velocity = 0.0;
-        int env_state = 0; // 0 no sound, 1 attack, 2 decay, 3 sustain, 4 release
+    Synth synth(engine_rate, a4, channel);
+    synth.set_polyphony(polyphony);
+    synth.stealing = stealing;
+    synth.instrument = instrument;
+    synth.band_limited = band_limited;
+    synth.additive = additive;
+    synth.workers = workers.get();
+    synth.parallel_voices = parallel_voices;
+    synth.channels = channels;
+    // engine periods vary by a frame around engine_frames when resampling
+    const size_t engine_frames = max<size_t>(1, frames*(uint64_t)engine_rate/rate);
+    vector<float> engine_mix(engine_frames * channels);
+    resampler output_resampler(engine_rate, rate, channels);
+    vector<float> mix(frames * channels);
+    // full scale is 1/volume in the mix, before convert() applies the volume
+    limiter master(rate, channels, 1/max(volume, 1e-6f));
+    // the recording gets its own conversion when it is dithered differently
+    ditherer output_dither(dither_or(dither_mode::off), channels);
+    ditherer record_dither(dither_or(dither_mode::tpdf), channels);
+    vector<int16_t> recorded(save && record_dither.mode != output_dither.mode ? buffer.size() : 0);
+
+    // jump to a time of the mid file. The voice state is replayed from the last seek point
+    // where a playback from the start is silent, control only (events and envelopes, nothing
+    // rendered) : release tails, retriggers and stolen voices come out as they would have, and
+    // playback goes on exactly as from the start. Positions stay on the period grid, which
+    // holds while the engine renders at the device rate (resampled periods vary by a frame)
+    // and spectral frames restart at the seek. Loops restore the state computed the first time
+    struct {
+        float seconds = -1;
+        synth_snapshot state;
+        size_t cursor = 0;
+    } seek_cache;
+    auto seek_to = [&](float seconds) {
+        synth.reset();
+        if (seconds == seek_cache.seconds) {
+            synth.restore(seek_cache.state);
+            mid_file_cursor = seek_cache.cursor;
+            return;
+        }
+        int64_t target = (int64_t)(seconds*engine_rate)/engine_frames*engine_frames;
+        // longest tail of a release from full level or of a stolen voice, the period that
+        // applied the release late included
+        float tail = (synth.sustain_level > 0 ? synth.release_time/synth.sustain_level : 0) +
+            synth.steal_time + 2.f*engine_frames/engine_rate;
+        auto &p = quiet_point(midi_seek_index, target/(float)engine_rate*tempo/60, tail*tempo/60);
+        synth.position = (int64_t)ceil((60/tempo)*p.timestamp*engine_rate/engine_frames)*engine_frames;
+        mid_file_cursor = p.cursor;
+        synth.sustain_pedal = p.sustain_pedal;
+        // pan as the last CC10 left it
+        synth.process_message({(unsigned char)(0xB0 | max(0, channel)), 10, p.pan});
+        // events applied at period starts, as the playback loop does
+        while (synth.position < target) {
+            while (mid_file_cursor < midi_events.size() &&
+                (60/tempo)*midi_events[mid_file_cursor].timestamp <= (synth.position/(float)engine_rate)) {
+                auto &msg = midi_events[mid_file_cursor++];
+                synth.process_message({msg.status, msg.data1, msg.data2});
+            }
+            synth.advance(engine_frames);
+        }
+        seek_cache = {seconds, synth.snapshot(), mid_file_cursor};
     };
 
-    vector<key_state> active_keys(kb.size());
+    if (input && start > 0) seek_to(start);
 
-    // global sustain pedal state
-    bool sustain_pedal = false;
-
-    const float attack = 0.02f;
-    const float decay = 0.3f;
-    const float sustain = 0.6f;
-    const float release = 0.05f;
+    // DSP load, printed by a monitor thread so the audio loop never waits on output
+    load_meter meter;
+    auto print_load = [&](const load_meter::stats &s) {
+        cout << "DSP load : p50 " << s.p50*100 << "%, p99 " << s.p99*100 << "%, max " << s.max*100
+            << "% (" << s.max_voices << " voices), " << s.overruns << " overruns over "
+            << s.periods << " periods" << endl;
+        if (limit) cout << "Limiter : max gain reduction " << master.collect_reduction() << "dB" << endl;
+    };
+    thread monitor;
+    if (verbose || stats_interval > 0) {
+        if (stats_interval <= 0) stats_interval = 5;
+        monitor = thread([&]() {
+            auto last = chrono::steady_clock::now();
+            while (!quit) {
+                this_thread::sleep_for(chrono::milliseconds(100));
+                if (chrono::steady_clock::now() - last >= chrono::duration<float>(stats_interval)) {
+                    last = chrono::steady_clock::now();
+                    print_load(meter.collect());
+                }
+            }
+        });
+    }
+    const double period_duration = frames/(double)rate;
+
+    while (!quit) {
+        auto period_begin = chrono::steady_clock::now();
+
+        // End of playback region
+        if (input && end >= 0 && synth.position >= (int64_t)(end*engine_rate)) {
+            if (loop_region) seek_to(start);
+            else {
+                // release everything and stop reading the file
+                synth.release_all();
+                mid_file_cursor = midi_events.size();
+                end = -1;
+            }
+        }
 
-    for (int64_t loop = 0; true; loop++) {
         // Get midi signals
         std::vector<unsigned char> message(1);
         while (!message.empty()) {
-            if (!input) {
+            if (!input && latency) {
+                // Controller through the latency probe
+                timed_message m;
+                message.clear();
+                if (probe.pop(m)) {
+                    message.assign(m.bytes, m.bytes + m.size);
+                    bool note_on = m.size == 3 && (m.bytes[0] & 0xF0) == 0x90 && m.bytes[2] > 0;
+                    if (note_on && (channel == -1 || (m.bytes[0] & 0x0F) == channel))
+                        probe.note_on(m.arrival, synth.position);
+                }
+            } else if (!input) {
                 // Controller
                 midiin.getMessage( &message );
             } else {
@@ -359,7 +507,7 @@ int main(int argc, char ** argv) {
                 if (mid_file_cursor < midi_events.size()) {
                     auto msg = midi_events[mid_file_cursor];
                     // math magic to convert midi timestamp to sample number
-                    if ((60/tempo)*msg.timestamp <= ((loop*frames)/(float)rate)) {
+                    if ((60/tempo)*msg.timestamp <= (synth.position/(float)engine_rate)) {
                         message = {msg.status, msg.data1, msg.data2};
                         mid_file_cursor++;
                     }
@@ -371,81 +519,40 @@ int main(int argc, char ** argv) {
                     cout << "MIDI INPUT ";
                     for (size_t i=0; i<message.size(); i++ )
                         cout << "Byte " << i << " = " << hex << (int)message[i] << ", ";
-                    cout << endl;
+                    cout << dec << endl;
                 }
             }
 
             // Process midi message
-            if (message.size()  == 3) {
-                int key = message[1] - 21;
-                if (key >= 0 && key < (int)kb.size()) {
-                    auto &key_s = active_keys[key];
-                    auto current_timestamp = loop*frames;
-                    if ((message[0] == 0x90+channel) || (channel==-1 && (message[0]&0xF0)==0x90)) {
-                        // if quick pressed or sustain dont reset timestamp
-                        if (key_s.env_state == 0) key_s.timestamp = current_timestamp;
-                        key_s.pressed = true;
-                        key_s.env_state = 1; // set attack
-                        key_s.velocity = velocity_curve(message[2]);
-                    }
-                    else if (message[0] == 0x80+channel || (channel==-1 && (message[0]&0xF0)==0x80)) {
-                        if (!sustain_pedal) {
-                            key_s.env_state = 4; // set release
-                        }
-                        key_s.pressed = false;
-                    }
-                    else if ((message[0] == (0xB0 + channel) || (channel==-1 && (message[0]&0xF0)==0xB0)    ) && message[1] == 64) {
-                        // Sustain
-                        if (message[2] == 127) {
-                            sustain_pedal = true;
-                        } else {
-                            // release all notes not pressed
-                            for (auto &k : active_keys) {
-                                if (!k.pressed) k.env_state = 4;
-                            }
-                            sustain_pedal = false;
-                        }
-                    }
-                }
-            }
+            synth.process_message(message);
         }
 
-        // Generate sound
-        for (size_t i=0;i<buffer.size();i++) {
-            int64_t sample_num = loop*frames+i;
-
-            float val = 0.0;
-
-            for (size_t j=0;j<kb.size();j++) {
-                auto &key_s = active_keys[j];
-                int64_t note_elapsed_samples = sample_num - key_s.timestamp;
-                if (key_s.env_state > 0) {
-                    val += key_s.vol*key_s.velocity*
-                        synth_sound(t_freq(note_elapsed_samples, kb[j]));
-
-                    // State machine for ADSR pattern
-                    if (key_s.env_state == 1) {
-                        key_s.vol += 1.0/(attack*rate);
-                        if (key_s.vol >= 1.0) key_s.env_state = 2;
-                    } else if (key_s.env_state == 2) {
-                        key_s.vol -= (1.0-sustain)/(decay*rate);
-                        if (key_s.vol < sustain) key_s.env_state = 3;
-                    } else if (key_s.env_state == 3) {
-                        key_s.vol = sustain;
-                    } else if (key_s.env_state == 4) {
-                        key_s.vol -= sustain/(release*rate);
-                        if (key_s.vol <= 0.0) key_s.env_state = 0;
-                    }
-
-                    key_s.vol = min(1.f, max(0.f, key_s.vol));
-                }
-            } 
+        // Generate sound at the engine rate, resampled to the device rate
+        size_t rendered = output_resampler.input_needed(frames);
+        if (engine_mix.size() < rendered*channels) engine_mix.resize(rendered*channels);
+        synth.render(engine_mix.data(), rendered);
+        output_resampler.process(engine_mix.data(), rendered, mix.data(), frames);
+        if (limit) master.process(mix.data(), frames);
+        output_dither.convert(mix.data(), buffer.data(), buffer.size(), volume);
 
-            buffer[i] = convert(val, volume);
+        // Save to file
+        if (save && recorded.empty()) full_buffer.insert(full_buffer.end(), buffer.begin(), buffer.end());
+        if (save && !recorded.empty()) {
+            record_dither.convert(mix.data(), recorded.data(), recorded.size(), volume);
+            full_buffer.insert(full_buffer.end(), recorded.begin(), recorded.end());
         }
 
-        // Save to file
-        if (save) full_buffer.insert(full_buffer.end(), buffer.begin(), buffer.end());
+        double render_time = chrono::duration<double>(chrono::steady_clock::now() - period_begin).count();
+        meter.record(render_time/period_duration, synth.voice_count());
+
+        if (latency) {
+            snd_pcm_sframes_t delay = 0;
+            snd_pcm_delay(pcm_handle, &delay);
+            // the resampler and the limiter hold their lookahead back, in engine samples
+            auto to_engine = [&](int64_t device_frames) { return device_frames*(int64_t)engine_rate/rate; };
+            probe.period_written(synth.position - rendered - output_resampler.latency() -
+                to_engine(limit ? master.latency() : 0), to_engine(delay), engine_rate);
+        }
 
         int result = snd_pcm_writei(pcm_handle, buffer.data(), frames);
         error(result);
@@ -453,7 +560,22 @@ int main(int argc, char ** argv) {
         if (result == -EPIPE) snd_pcm_prepare(pcm_handle);
     }
 
+    if (monitor.joinable()) {
+        monitor.join();
+        auto last_stats = meter.collect();
+        if (last_stats.periods > 0) print_load(last_stats);
+    }
+
+    if (loopback.joinable()) loopback.join();
+    if (loopback_dropped > 0) cout << "Loopback input dropped " << loopback_dropped << " messages" << endl;
+    if (latency) probe.report();
+
     snd_pcm_drain(pcm_handle);    
     snd_pcm_close(pcm_handle);
+
+    if (save) {
+        write_wav(save_filename, full_buffer, channels, rate);
+        if (verbose) cout << save_filename << " saved." << endl;
+    }
     return 0;
 }
\ No newline at end of file
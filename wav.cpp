@@ -0,0 +1,69 @@
+#include "wav.h"
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+void write_wav(const string &filename, const vector<int16_t> &samples, unsigned int channels, unsigned int rate) {
+    ofstream file(filename.c_str(), ios::out | ios::binary);
+
+    file << "RIFF";
+
+    int32_t file_size = samples.size()*2 + 44;
+    int32_t fmt_len = 16;
+    int16_t fmt_type = 1;
+    int16_t fmt_channels = channels;
+    int32_t fmt_rate = rate;
+    int32_t fmt_bits_per_sample = 16;
+    int32_t fmt_bytes_per_sample = fmt_bits_per_sample*fmt_channels/8;
+    int32_t fmt_bytes_sec = fmt_rate*fmt_bytes_per_sample;
+    int32_t data_size = samples.size()*2;
+
+    file.write((char*)&file_size, sizeof(int32_t));
+    file << "WAVEfmt ";
+    file.write((char*)&fmt_len, sizeof(int32_t));
+    file.write((char*)&fmt_type, sizeof(int16_t));
+    file.write((char*)&fmt_channels, sizeof(int16_t));
+    file.write((char*)&fmt_rate, sizeof(int32_t));
+    file.write((char*)&fmt_bytes_sec, sizeof(int32_t));
+    file.write((char*)&fmt_bytes_per_sample, sizeof(int16_t));
+    file.write((char*)&fmt_bits_per_sample, sizeof(int16_t));
+    file << "data";
+    file.write((char*)&data_size, sizeof(int32_t));
+
+    file.write((char*)samples.data(), samples.size()*sizeof(int16_t));
+
+    file.flush();
+}
+
+vector<int16_t> read_wav(const string &filename, unsigned int* channels) {
+    ifstream file(filename, ios::in | ios::binary);
+    if (!file) throw "cannot open wav file";
+    vector<char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(&data[8], "WAVE", 4) != 0)
+        throw "not a wav file";
+
+    // walk chunks up to the samples
+    size_t c = 12;
+    while (c + 8 <= data.size()) {
+        uint32_t size;
+        memcpy(&size, &data[c+4], 4);
+        if (memcmp(&data[c], "fmt ", 4) == 0) {
+            int16_t type, fmt_channels, bits;
+            memcpy(&type, &data[c+8], 2);
+            memcpy(&fmt_channels, &data[c+10], 2);
+            memcpy(&bits, &data[c+22], 2);
+            if (type != 1 || fmt_channels < 1 || bits != 16) throw "unsupported wav format";
+            if (channels) *channels = fmt_channels;
+        } else if (memcmp(&data[c], "data", 4) == 0) {
+            size = min<size_t>(size, data.size() - c - 8);
+            vector<int16_t> samples(size/2);
+            memcpy(samples.data(), &data[c+8], samples.size()*2);
+            return samples;
+        }
+        c += 8 + size;
+    }
+    throw "no samples in wav file";
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Writes 16 bits samples at rate to a wav file, interleaved if there are several channels
+void write_wav(const std::string &filename, const std::vector<int16_t> &samples, unsigned int channels = 1,
+    unsigned int rate = 48000);
+
+// Reads 16 bits samples of a wav file written by write_wav, interleaved, and their number of
+// channels if channels is set. Throws a message on error
+std::vector<int16_t> read_wav(const std::string &filename, unsigned int* channels = nullptr);